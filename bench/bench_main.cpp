@@ -0,0 +1,998 @@
+// Host microbenchmarks for the firmware's core modules.
+//
+//   pio run -e native_bench -t exec
+//   .pio/build/native_bench/program [--save] [--baseline <file>]
+//
+// Reports ns/op, heap allocations/op, and bytes written to the simulated
+// flash and I2C bus per op, then footswitch latency, how far apart the beat
+// outputs land and how late the beat LED gets behind flash stalls, all in
+// simulated time, serial command-to-beat latency, and the web server under
+// simulated network load with the beat running. Results are compared against
+// a local baseline file and regressions are flagged; --save records the
+// current run as the new baseline. A beat missed under load fails the run.
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <Schedule.h>
+#include <chrono>
+#include <cmath>
+#include <new>
+#include <vector>
+#include "config.h"
+#include "types.h"
+#include "display.h"
+#include "buttons.h"
+#include "metronome.h"
+#include "storage.h"
+#include "api_json.h"
+#include "realtime.h"
+#include "serial_control.h"
+#include "control.h"
+#include "tempo_curve.h"
+#include "patch_table.h"
+#include "wifi_manager.h"
+
+// Slower than baseline by more than this fraction counts as a regression
+#define TIME_TOLERANCE 0.20
+
+static unsigned long allocations = 0;
+
+void *operator new(size_t size)
+{
+    allocations++;
+    if (void *ptr = malloc(size ? size : 1))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+
+struct Result
+{
+    std::string name;
+    double nsPerOp;
+    double allocsPerOp;
+    double flashBytesPerOp;
+    double i2cBytesPerOp;
+};
+
+template <typename Op>
+static Result run(const char *name, unsigned long iterations, Op op)
+{
+    // Warm up caches and any lazy allocations
+    for (unsigned long i = 0; i < iterations / 10 + 1; i++)
+    {
+        op(i);
+    }
+
+    unsigned long allocsBefore = allocations;
+    unsigned long flashBefore = EEPROM.bytesCommitted;
+    unsigned long i2cBefore = Adafruit_AlphaNum4::i2cBytes;
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        op(i);
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+
+    return {name,
+            ns / iterations,
+            double(allocations - allocsBefore) / iterations,
+            double(EEPROM.bytesCommitted - flashBefore) / iterations,
+            double(Adafruit_AlphaNum4::i2cBytes - i2cBefore) / iterations};
+}
+
+static void fillPatchTable(Patch *patches)
+{
+    static const char *names[MAX_PATCHES] = {"INTR", "VRS1", "CHRS", "VRS2", "BRDG",
+                                             "SOLO", "OUTR", "BALL", "FAST", "ENCR"};
+    for (int i = 0; i < MAX_PATCHES; i++)
+    {
+        strlcpy(patches[i].name, names[i], sizeof(patches[i].name));
+        patches[i].tempo = 60 + i * 17;
+    }
+}
+
+// Pin levels as (level, microseconds held), a press with contact bounce
+struct PinStep
+{
+    int level;
+    unsigned long duration;
+};
+
+static const PinStep pressTrace[] = {
+    {LOW, 300}, {HIGH, 200}, {LOW, 500}, {HIGH, 150}, {LOW, 120000},
+    {HIGH, 400}, {LOW, 250}, {HIGH, 80000},
+};
+
+// Serial port in simulated time. Injected bytes arrive one every 87 us,
+// as at 115200 baud, and whatever the pedal sends is kept for inspection.
+class SimSerial : public Stream
+{
+public:
+    void inject(const uint8_t *data, size_t length)
+    {
+        unsigned long arrival = max(micros(), rxCount ? rxArrival[(rxHead + rxCount - 1) % sizeof(rx)] : 0);
+        for (size_t i = 0; i < length; i++)
+        {
+            arrival += 87;
+            rx[(rxHead + rxCount) % sizeof(rx)] = data[i];
+            rxArrival[(rxHead + rxCount) % sizeof(rx)] = arrival;
+            rxCount++;
+        }
+    }
+
+    int available() override
+    {
+        int count = 0;
+        while (count < rxCount && (long)(micros() - rxArrival[(rxHead + count) % sizeof(rx)]) >= 0)
+        {
+            count++;
+        }
+        return count;
+    }
+
+    int read() override
+    {
+        uint8_t byte = rx[rxHead];
+        rxHead = (rxHead + 1) % sizeof(rx);
+        rxCount--;
+        return byte;
+    }
+
+    size_t write(const uint8_t *buffer, size_t size) override
+    {
+        size_t n = min(size, sizeof(tx));
+        memcpy(tx, buffer, n);
+        txLength = n;
+        return size;
+    }
+
+    uint8_t tx[16];
+    size_t txLength = 0;
+
+private:
+    uint8_t rx[64];
+    unsigned long rxArrival[64];
+    int rxHead = 0;
+    int rxCount = 0;
+};
+
+// Encodes a host-to-pedal frame as tools/serial_control.py does
+static size_t serialFrame(uint8_t *frame, SerialFrameType type, const uint8_t *payload, uint8_t length)
+{
+    frame[0] = SERIAL_SYNC;
+    frame[1] = type;
+    frame[2] = length;
+    memcpy(frame + 3, payload, length);
+
+    uint8_t crc = 0;
+    for (int i = 1; i < 3 + length; i++)
+    {
+        crc ^= frame[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    frame[3 + length] = crc;
+    return length + 4;
+}
+
+static size_t tempoFrame(uint8_t *frame, uint16_t tempo)
+{
+    uint8_t payload[2] = {uint8_t(tempo & 0xFF), uint8_t(tempo >> 8)};
+    return serialFrame(frame, SERIAL_SET_TEMPO, payload, sizeof(payload));
+}
+
+static std::vector<Result> runAll()
+{
+    std::vector<Result> results;
+    static Patch patches[MAX_PATCHES];
+    fillPatchTable(patches);
+
+    Display display;
+    display.begin();
+
+    results.push_back(run("display_patch_name", 100000, [&](unsigned long i)
+                          { display.update(PATCH_MODE, i % MAX_PATCHES, patches, 120, true, true, false); }));
+    results.push_back(run("display_patch_tempo", 100000, [&](unsigned long i)
+                          { display.update(PATCH_MODE, i % MAX_PATCHES, patches, 120, false, true, true); }));
+    results.push_back(run("display_free_mode", 100000, [&](unsigned long i)
+                          { display.update(FREE_MODE, 0, patches, 40 + i % 200, false, false, false); }));
+
+    storage.begin();
+    storage.savePatches(patches, MAX_PATCHES);
+    Patch loaded[MAX_PATCHES];
+
+    results.push_back(run("storage_load_patches", 100000, [&](unsigned long)
+                          { storage.loadPatches(loaded, MAX_PATCHES); }));
+    results.push_back(run("storage_save_unchanged", 100000, [&](unsigned long)
+                          { storage.savePatches(patches, MAX_PATCHES); }));
+    results.push_back(run("storage_save_changed", 100000, [&](unsigned long i)
+                          {
+        patches[i % MAX_PATCHES].tempo = 40 + i % 200;
+        storage.savePatches(patches, MAX_PATCHES); }));
+    fillPatchTable(patches);
+
+    results.push_back(run("api_get_patches", 50000, [&](unsigned long)
+                          {
+        String response;
+        patchesToJson(patches, MAX_PATCHES, response); }));
+
+    // Request mix as data/app.js produces it: mostly page loads and edits
+    static const char *putBody = "{\"index\":3,\"patch\":{\"name\":\"VRS2\",\"tempo\":132}}";
+    static const char *postBody = "{\"name\":\"NEW\",\"tempo\":96}";
+    static const char *deleteBody = "{\"index\":4}";
+
+    results.push_back(run("api_request_mix", 50000, [&](unsigned long i)
+                          {
+        StaticJsonDocument<PATCH_REQUEST_JSON_SIZE> doc;
+        Patch patch;
+        switch (i % 8) {
+        case 0: case 1: case 2: case 3: {
+            String response;
+            patchesToJson(patches, MAX_PATCHES, response);
+            break;
+        }
+        case 4: case 5: case 6:
+            deserializeJson(doc, i % 8 == 6 ? postBody : putBody);
+            patchFromJson(i % 8 == 6 ? doc.as<JsonVariantConst>() : doc["patch"], patch);
+            break;
+        default:
+            deserializeJson(doc, deleteBody);
+            (void)(doc["index"] | -1);
+            break;
+        } }));
+
+    // One beat of a slow sweep, the per-beat cost of a ramp
+    TempoRamp ramp;
+    const TempoCurve sweep = {CURVE_LINEAR, 0, 1000, 140};
+    results.push_back(run("tempo_ramp_beat", 100000, [&](unsigned long i)
+                          {
+        if (i % 4000 == 0) {
+            ramp.start(90, sweep);
+        }
+        ramp.nextInterval(); }));
+
+    Metronome metronome;
+    metronome.begin();
+
+    // Bursts of four taps around 120 BPM with a little human jitter
+    results.push_back(run("metronome_tap_burst", 100000, [&](unsigned long i)
+                          {
+        sim::advanceMicros(i % 4 == 0 ? 3000000 : 490000 + (i * 7919) % 20000);
+        metronome.tap(millis()); }));
+
+    Buttons buttons;
+    buttons.begin();
+
+    results.push_back(run("buttons_press_trace", 20000, [&](unsigned long)
+                          {
+        for (const PinStep &step : pressTrace) {
+            sim::setPin(RIGHT_SWITCH_PIN, step.level);
+            for (unsigned long t = 0; t < step.duration; t += 1000) {
+                sim::advanceMicros(1000);
+                Gesture gesture;
+                if (buttons.update()) {
+                    while (buttons.nextGesture(gesture)) {
+                    }
+                }
+            }
+        } }));
+
+    SimSerial port;
+    SerialControl serialControl(port);
+    uint8_t frame[16];
+    size_t frameLength = tempoFrame(frame, 132);
+
+    // Arrival is simulated, so bytes are all there by the time update() runs
+    results.push_back(run("serial_parse_frame", 100000, [&](unsigned long)
+                          {
+        port.inject(frame, frameLength);
+        sim::advanceMicros(1000);
+        SerialCommand command;
+        serialControl.update();
+        while (serialControl.nextCommand(command)) {
+        } }));
+
+    return results;
+}
+
+// Time from the first contact edge to each gesture, polling like loop() does
+static void reportInputLatency()
+{
+    Buttons buttons;
+    buttons.begin();
+    sim::advanceMicros(1000000);
+
+    unsigned long pressEdge = 0;
+    unsigned long releaseEdge = 0;
+    unsigned long pressLatency = 0;
+    unsigned long clickLatency = 0;
+
+    bool held = false;
+
+    for (const PinStep &step : pressTrace)
+    {
+        sim::setPin(RIGHT_SWITCH_PIN, step.level);
+        if (step.level == LOW && !pressEdge)
+        {
+            pressEdge = micros();
+        }
+        else if (step.level == HIGH && held && !releaseEdge)
+        {
+            releaseEdge = micros();
+        }
+        held = held || (step.level == LOW && step.duration > DEBOUNCE_TIME * 1000);
+
+        for (unsigned long t = 0; t < step.duration; t += 100)
+        {
+            sim::advanceMicros(100);
+            Gesture gesture;
+            buttons.update();
+            while (buttons.nextGesture(gesture))
+            {
+                if (gesture.type == GESTURE_PRESS)
+                {
+                    pressLatency = micros() - pressEdge;
+                }
+                else if (gesture.type == GESTURE_CLICK)
+                {
+                    clickLatency = micros() - releaseEdge;
+                }
+            }
+        }
+    }
+
+    printf("\nFootswitch latency (simulated, bouncy contact): press %lu us, click %lu us after the release\n",
+           pressLatency, clickLatency);
+}
+
+// Beat output landing times in simulated time, where a display write takes
+// as long as the real I2C transfer
+static Display *cueDisplay;
+static unsigned long ledLanded;
+static unsigned long displayLanded;
+
+static void ledOutput(bool active)
+{
+    if (active)
+    {
+        ledLanded = micros();
+    }
+}
+
+static void displayOutput(bool active)
+{
+    cueDisplay->setBeatCue(active);
+    if (active)
+    {
+        displayLanded = micros();
+    }
+}
+
+// Worst LED/display landing difference over a run of beats, in us
+static unsigned long measureOutputSpread(Metronome &metronome)
+{
+    unsigned long worst = 0;
+    metronome.start();
+
+    for (int beat = 0; beat < 32; beat++)
+    {
+        ledLanded = displayLanded = 0;
+        while (!ledLanded || !displayLanded)
+        {
+            sim::advanceMicros(100);
+            metronome.update(true);
+        }
+        unsigned long spread = ledLanded > displayLanded ? ledLanded - displayLanded
+                                                         : displayLanded - ledLanded;
+        worst = max(worst, spread);
+    }
+
+    metronome.stop();
+    return worst;
+}
+
+static void reportOutputAlignment()
+{
+    Display display;
+    cueDisplay = &display;
+
+    Metronome metronome;
+    metronome.begin();
+    BeatOutputs &outputs = metronome.getOutputs();
+    outputs.attach(OUTPUT_LED, ledOutput, BEAT_PULSE_LENGTH);
+    outputs.attach(OUTPUT_DISPLAY, displayOutput, BEAT_PULSE_LENGTH);
+
+    unsigned long uncompensated = measureOutputSpread(metronome);
+    unsigned long ledOffset = outputs.calibrate(OUTPUT_LED);
+    unsigned long displayOffset = outputs.calibrate(OUTPUT_DISPLAY);
+    unsigned long compensated = measureOutputSpread(metronome);
+
+    printf("\nOutput alignment (simulated): led %lu us, display %lu us latency\n",
+           ledOffset, displayOffset);
+    printf("  LED/display spread %lu us uncompensated, %lu us compensated\n",
+           uncompensated, compensated);
+}
+
+// Beat LED lateness when loop() keeps getting stuck in 30 ms flash commits
+static Metronome *stallMetronome;
+static unsigned long polledLateness;
+
+static void polledLed(bool active)
+{
+    if (active)
+    {
+        polledLateness = max(polledLateness, micros() - stallMetronome->getNextBeat());
+    }
+}
+
+static void runWithStalls(Metronome &metronome)
+{
+    // The first beat after start goes out at once, count from the second
+    metronome.start();
+    metronome.update(true);
+    sim::advanceMicros(100);
+    metronome.update(true);
+    polledLateness = 0;
+    realtimeCore.resetLedLateness();
+
+    for (unsigned long pass = 1; pass < 320000; pass++)
+    {
+        sim::advanceMicros(pass % 2003 == 0 ? 30000 : 100);
+        metronome.update(true);
+    }
+    metronome.stop();
+}
+
+static void reportStallLateness()
+{
+    Metronome polled;
+    polled.begin();
+    polled.getOutputs().attach(OUTPUT_LED, polledLed, BEAT_PULSE_LENGTH);
+    stallMetronome = &polled;
+    runWithStalls(polled);
+    unsigned long polledWorst = polledLateness;
+
+    Metronome timed;
+    timed.begin();
+    runWithStalls(timed);
+
+    printf("\nBeat LED under 30 ms loop stalls (simulated): polled %lu us, timer %lu us worst lateness\n",
+           polledWorst, realtimeCore.getMaxLedLateness());
+}
+
+// Tempo changes sent at random points in the beat and handed to the
+// scheduler the way loop() does it. Latency runs from the first byte on the
+// wire to the beat the new tempo starts from.
+static void reportSerialLatency()
+{
+    SimSerial port;
+    SerialControl serialControl(port);
+    Metronome metronome;
+    metronome.begin();
+    metronome.setTempo(120);
+    metronome.start();
+
+    unsigned long sent = 0;
+    unsigned long worst = 0;
+    unsigned long total = 0;
+    int samples = 0;
+    uint16_t requested = 120;
+    unsigned long effectTime = 0;
+    unsigned long worstDecode = 0;
+    uint32_t beatCount = 0;
+
+    for (unsigned long pass = 0; pass < 400000; pass++)
+    {
+        sim::advanceMicros(100);
+        metronome.update(true);
+
+        if (!sent && pass % 7919 == 0)
+        {
+            uint8_t frame[16];
+            requested = requested == 120 ? 150 : 120;
+            port.inject(frame, tempoFrame(frame, requested));
+            sent = micros();
+        }
+
+        if (serialControl.update())
+        {
+            SerialCommand command;
+            while (serialControl.nextCommand(command))
+            {
+                worstDecode = max(worstDecode, micros() - sent);
+                effectTime = metronome.setTempo(command.value, command.when);
+            }
+        }
+
+        bool newBeat = metronome.getBeatCount() != beatCount;
+        beatCount = metronome.getBeatCount();
+        if (newBeat && effectTime && metronome.getLastBeat() == effectTime)
+        {
+            unsigned long latency = effectTime - sent;
+            worst = max(worst, latency);
+            total += latency;
+            samples++;
+            effectTime = 0;
+            sent = 0;
+        }
+    }
+
+    printf("\nSerial tempo change (simulated, 115200 baud): frame decoded %lu us after its first byte\n",
+           worstDecode);
+    printf("  to the beat it takes effect on: mean %lu us, worst %lu us over %d changes\n",
+           samples ? total / samples : 0, worst, samples);
+}
+
+static double percentile(std::vector<unsigned long> values, double fraction)
+{
+    if (values.empty())
+    {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t rank = (size_t)ceil(fraction * values.size());
+    return values[max(rank, (size_t)1) - 1];
+}
+
+// xorshift32, the same presses on every run
+static uint32_t nextRandom(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// Live Gig patch steps at random points in the beat, made as loop() makes
+// them: the press sets the patch's tempo and curve for the next beat, then
+// the same pass redraws the display. Host time covers both; simulated time
+// runs from the press to the end of the display write and to the beat the
+// new tempo starts on.
+static void reportPatchSteps()
+{
+    const int presses = 2000;
+    static PatchSnapshot table;
+    fillPatchTable(table.patches);
+    table.count = MAX_PATCHES;
+    table.patches[3].curve = {CURVE_LINEAR, 0, 8, 180};
+    table.patches[7].curve = {CURVE_STEP, -4, 2, 120};
+
+    Display display;
+    display.begin();
+    Metronome metronome;
+    metronome.begin();
+    int index = 0;
+    metronome.setTempo(table.patches[index].tempo);
+    metronome.start();
+
+    std::vector<unsigned long> displayLatency;
+    std::vector<unsigned long> tempoLatency;
+    double ns = 0;
+    unsigned long allocs = 0;
+    int late = 0; // New tempo not in effect from the next beat
+    uint32_t state = 0x5EED;
+    for (int press = 0; press < presses; press++)
+    {
+        unsigned long gap = 200000 + nextRandom(state) % 1500000;
+        for (unsigned long t = 0; t < gap; t += 1000)
+        {
+            sim::advanceMicros(1000);
+            metronome.update(true);
+        }
+
+        // Mostly forward, as a set list runs
+        index = (index + (nextRandom(state) % 4 == 0 ? table.count - 1 : 1)) % table.count;
+        const Patch &patch = table.patches[index];
+        unsigned long nextBeat = metronome.getNextBeat();
+        unsigned long pressTime = micros();
+        unsigned long allocsBefore = allocations;
+        auto start = std::chrono::steady_clock::now();
+        unsigned long effect = metronome.setTempo(patch.tempo, PATCH_TEMPO_CHANGE, &patch.curve);
+        display.update(PATCH_MODE, index, table.patches, metronome.getTempo(), true, true, true);
+        ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        allocs += allocations - allocsBefore;
+        displayLatency.push_back(micros() - pressTime);
+        tempoLatency.push_back(effect - pressTime);
+
+        while (metronome.getLastBeat() != effect && (long)(micros() - effect) < 1000000)
+        {
+            sim::advanceMicros(1000);
+            metronome.update(true);
+        }
+        late += effect != nextBeat || metronome.getLastBeat() != effect || metronome.getTempo() != patch.tempo;
+    }
+    metronome.stop();
+
+    printf("\nLive Gig patch steps (simulated, %d presses at random points in the beat, 1 ms loop passes):\n",
+           presses);
+    printf("  press path %.1f ns, %.2f allocs; display written after %.2f ms max; new tempo after %.1f ms p50, "
+           "%.1f ms max; %d not on the next beat\n",
+           ns / presses, double(allocs) / presses, percentile(displayLatency, 1.0) / 1000,
+           percentile(tempoLatency, 0.5) / 1000, percentile(tempoLatency, 1.0) / 1000, late);
+}
+
+// A browser tab or script that sends its requests in turn, each once the
+// previous response is in
+struct LoadClient
+{
+    std::vector<std::string> requests;
+    unsigned long byteGap;   // us per byte on the way in
+    unsigned long thinkTime; // us from a response to the next request
+
+    size_t next;
+    unsigned long nextStart;
+    bool open;
+    sim::HttpClient connection;
+};
+
+struct HttpScenario
+{
+    const char *name;
+    std::vector<LoadClient> clients;
+};
+
+static std::string httpRequest(const char *method, const char *uri, const std::string &body = "")
+{
+    std::string request = std::string(method) + " " + uri + " HTTP/1.1\r\nHost: 192.168.1.50\r\n";
+    if (!body.empty())
+    {
+        request += "Content-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) + "\r\n";
+    }
+    return request + "\r\n" + body;
+}
+
+static LoadClient loadClient(std::vector<std::string> requests, unsigned long byteGap, unsigned long thinkTime)
+{
+    LoadClient client;
+    client.requests = std::move(requests);
+    client.byteGap = byteGap;
+    client.thinkTime = thinkTime;
+    client.next = 0;
+    client.nextStart = 0;
+    client.open = false;
+    return client;
+}
+
+// PUT bodies as data/app.js sends them when a field is edited
+static std::vector<std::string> editRequests(int index)
+{
+    std::vector<std::string> requests;
+    for (int tempo = 100; tempo < 110; tempo++)
+    {
+        std::string patch = "{\"name\":\"VRS" + std::to_string(index) + "\",\"tempo\":" + std::to_string(tempo);
+        if (tempo % 3 == 0)
+        {
+            patch += ",\"curve\":{\"type\":\"linear\",\"end\":140,\"bars\":16,\"step\":5}";
+        }
+        requests.push_back(httpRequest("PUT", "/api/patches",
+                                       "{\"index\":" + std::to_string(index) + ",\"patch\":" + patch + "}}"));
+    }
+    return requests;
+}
+
+// Click onsets against the beat grid, the click is polled from loop() and
+// held up by anything that blocks it
+static Metronome *loadMetronome;
+static std::vector<unsigned long> clickErrors;
+static std::vector<unsigned long> clickBeats;
+
+static void clickOutput(bool active)
+{
+    if (active)
+    {
+        unsigned long beat = loadMetronome->getNextBeat();
+        clickErrors.push_back(micros() - (beat - loadMetronome->getOutputs().getOffset(OUTPUT_CLICK)));
+        clickBeats.push_back(beat);
+    }
+}
+
+// Web interface changes as main.cpp's handleControl() applies them
+static void applyControl(PatchTable &table)
+{
+    PatchSnapshot *edit = nullptr;
+    const ControlCommand *command;
+    while ((command = controlQueue.peek()))
+    {
+        if (command->type == CONTROL_SET_BRIGHTNESS)
+        {
+            storage.saveSettings({command->value});
+        }
+        else
+        {
+            if (!edit && !(edit = table.beginEdit()))
+            {
+                break;
+            }
+            applyPatchCommand(*command, *edit);
+        }
+        controlQueue.pop();
+    }
+
+    if (edit)
+    {
+        table.publish();
+        storage.savePatches(table.read().patches, table.read().count);
+    }
+}
+
+// Takes the response once the server closes the connection and connects
+// again after the client's think time. Returns true when a request finished,
+// with its status (0 when dropped) and latency.
+static bool stepClient(LoadClient &client, int &status, unsigned long &latency)
+{
+    bool finished = client.open && client.connection.done;
+    if (finished)
+    {
+        client.open = false;
+        client.nextStart = client.connection.done + client.thinkTime;
+        status = client.connection.status;
+        latency = client.connection.done - client.connection.start;
+    }
+    if (!client.open && (long)(micros() - client.nextStart) >= 0)
+    {
+        client.connection = sim::HttpClient();
+        client.connection.request = client.requests[client.next++ % client.requests.size()];
+        client.connection.start = micros();
+        client.connection.byteGap = client.byteGap;
+        sim::connectClient(&client.connection);
+        client.open = true;
+    }
+    return finished;
+}
+
+// Returns the beats missed
+static unsigned long runHttpScenario(HttpScenario &scenario, unsigned long duration)
+{
+    PatchTable table;
+    PatchSnapshot *initial = table.beginEdit();
+    fillPatchTable(initial->patches);
+    initial->count = MAX_PATCHES;
+    table.publish();
+    table.read();
+
+    Settings settings = {1};
+    Display display;
+    display.begin();
+    Metronome metronome;
+    metronome.begin();
+    metronome.getOutputs().attach(OUTPUT_CLICK, clickOutput, BEAT_PULSE_LENGTH);
+    loadMetronome = &metronome;
+
+    WiFiManager web(table, settings, display, metronome);
+    web.begin();
+    web.update();
+
+    // The first beat after start goes out at once, count from the second
+    metronome.setTempo(120);
+    metronome.start();
+    metronome.update(true);
+    sim::advanceMicros(100);
+    metronome.update(true);
+    clickErrors.clear();
+    clickBeats.clear();
+    realtimeCore.resetLedLateness();
+    unsigned long begin = micros();
+    clickBeats.push_back(metronome.getLastBeat());
+    for (auto &client : scenario.clients)
+    {
+        client.nextStart = begin;
+    }
+
+    std::vector<unsigned long> latencies;
+    int served = 0;
+    int failed = 0;
+    while (micros() - begin < duration)
+    {
+        sim::advanceMicros(100);
+        metronome.update(true);
+        web.update();
+        applyControl(table);
+
+        for (auto &client : scenario.clients)
+        {
+            int status;
+            unsigned long latency;
+            if (stepClient(client, status, latency))
+            {
+                if (status)
+                {
+                    served++;
+                    latencies.push_back(latency);
+                }
+                else
+                {
+                    failed++;
+                }
+            }
+        }
+    }
+    unsigned long elapsed = micros() - begin;
+    metronome.stop();
+    sim::resetNetwork();
+    sim::clearSchedule();
+
+    // A loop() stalled for longer than a beat drops the beats it sat through,
+    // the one due last may still be on its way
+    unsigned long interval = 60000000UL / metronome.getTempo();
+    unsigned long missed = 0;
+    for (size_t i = 1; i < clickBeats.size(); i++)
+    {
+        missed += (clickBeats[i] - clickBeats[i - 1] + interval / 2) / interval - 1;
+    }
+    missed += max((micros() - clickBeats.back()) / interval, 1UL) - 1;
+    printf("  %-24s %7.1f req/s  p99 %8.1f ms  %3d failed   click p99 %6.1f ms, worst %7.1f ms, %lu missed, LED worst %lu us\n",
+           scenario.name, served * 1e6 / elapsed, percentile(latencies, 0.99) / 1000, failed,
+           percentile(clickErrors, 0.99) / 1000, percentile(clickErrors, 1.0) / 1000, missed,
+           realtimeCore.getMaxLedLateness());
+    return missed;
+}
+
+// The web server and the beat in one simulated loop(), with clients on a
+// simulated network. Each scenario reports request throughput and tail
+// latency next to how far the beat onsets landed from the grid. Returns the
+// beats missed over all of them.
+static unsigned long reportHttpStress()
+{
+    const unsigned long duration = 10000000;
+    const unsigned long lan = 1; // us per byte, about 8 Mbit/s
+    std::string getPatches = httpRequest("GET", "/api/patches");
+    std::vector<std::string> pageLoad = {httpRequest("GET", "/"), getPatches, httpRequest("GET", "/api/settings")};
+
+    std::vector<HttpScenario> scenarios = {
+        {"idle", {}},
+        {"4 clients GET patches", {}},
+        {"2 browsers loading page", {}},
+        {"slow loris + 2 GETs", {}},
+        {"PUT bursts from 2 tabs", {}},
+        {"oversized bodies + GET", {}},
+    };
+    for (int i = 0; i < 4; i++)
+    {
+        scenarios[1].clients.push_back(loadClient({getPatches}, lan, 0));
+    }
+    scenarios[2].clients.push_back(loadClient(pageLoad, lan, 0));
+    scenarios[2].clients.push_back(loadClient(pageLoad, lan, 0));
+
+    // Each byte just inside the core's 5 s read timeout
+    scenarios[3].clients.push_back(loadClient({getPatches}, 4000000, 0));
+    scenarios[3].clients.push_back(loadClient({getPatches}, lan, 0));
+    scenarios[3].clients.push_back(loadClient({getPatches}, lan, 0));
+
+    scenarios[4].clients.push_back(loadClient(editRequests(2), lan, 20000));
+    scenarios[4].clients.push_back(loadClient(editRequests(5), lan, 20000));
+
+    std::string padding(4096, ' ');
+    std::string large = httpRequest("PUT", "/api/patches", "{\"index\":1,\"patch\":{\"name\":\"BIG\",\"tempo\":100}" + padding + "}");
+    std::string huge = httpRequest("PUT", "/api/patches", std::string(32768, '['));
+    scenarios[5].clients.push_back(loadClient({large, huge}, lan, 100000));
+    scenarios[5].clients.push_back(loadClient({getPatches}, lan, 0));
+
+    printf("\nHTTP load with the beat at 120 BPM (simulated, %lu s per scenario, %lu us round trip, %lu us per request):\n",
+           duration / 1000000, sim::netRoundTrip, sim::requestCpuTime);
+    unsigned long missed = 0;
+    for (auto &scenario : scenarios)
+    {
+        missed += runHttpScenario(scenario, duration);
+    }
+    return missed;
+}
+
+static std::vector<Result> loadBaseline(const char *path)
+{
+    std::vector<Result> baseline;
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        return baseline;
+    }
+
+    char name[64];
+    Result result;
+    while (fscanf(file, "%63s %lf %lf %lf %lf", name, &result.nsPerOp, &result.allocsPerOp,
+                  &result.flashBytesPerOp, &result.i2cBytesPerOp) == 5)
+    {
+        result.name = name;
+        baseline.push_back(result);
+    }
+    fclose(file);
+    return baseline;
+}
+
+static void saveBaseline(const char *path, const std::vector<Result> &results)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+    {
+        fprintf(stderr, "Could not write %s\n", path);
+        return;
+    }
+
+    for (const Result &result : results)
+    {
+        fprintf(file, "%s %.1f %.3f %.3f %.3f\n", result.name.c_str(), result.nsPerOp,
+                result.allocsPerOp, result.flashBytesPerOp, result.i2cBytesPerOp);
+    }
+    fclose(file);
+    printf("Baseline saved to %s\n", path);
+}
+
+int main(int argc, char **argv)
+{
+    const char *baselinePath = "bench/baseline.txt";
+    bool save = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--save") == 0)
+        {
+            save = true;
+        }
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+        {
+            baselinePath = argv[++i];
+        }
+    }
+
+    realtimeCore.begin();
+    std::vector<Result> results = runAll();
+    std::vector<Result> baseline = loadBaseline(baselinePath);
+    int regressions = 0;
+
+    printf("%-24s %12s %10s %12s %10s\n", "benchmark", "ns/op", "allocs/op", "flash B/op", "i2c B/op");
+    for (const Result &result : results)
+    {
+        const char *flag = "";
+        for (const Result &base : baseline)
+        {
+            if (base.name != result.name)
+            {
+                continue;
+            }
+            if (result.nsPerOp > base.nsPerOp * (1 + TIME_TOLERANCE) ||
+                result.allocsPerOp > base.allocsPerOp + 0.001 ||
+                result.flashBytesPerOp > base.flashBytesPerOp + 0.001 ||
+                result.i2cBytesPerOp > base.i2cBytesPerOp + 0.001)
+            {
+                flag = "  REGRESSION";
+                regressions++;
+            }
+        }
+
+        printf("%-24s %12.1f %10.3f %12.3f %10.3f%s\n", result.name.c_str(), result.nsPerOp,
+               result.allocsPerOp, result.flashBytesPerOp, result.i2cBytesPerOp, flag);
+    }
+
+    reportInputLatency();
+    reportOutputAlignment();
+    reportStallLateness();
+    reportSerialLatency();
+    reportPatchSteps();
+    unsigned long missedBeats = reportHttpStress();
+
+    if (missedBeats)
+    {
+        printf("%lu beat(s) missed under HTTP load\n", missedBeats);
+        return 1;
+    }
+    if (save || baseline.empty())
+    {
+        saveBaseline(baselinePath, results);
+    }
+    else if (regressions)
+    {
+        printf("%d regression(s) against %s\n", regressions, baselinePath);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+// Minimal Arduino API for the host benchmarks and unit tests. Time is
+// simulated and only moves when a benchmark or test advances it.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include "user_interface.h"
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 3
+
+#define PROGMEM
+#define PGM_P const char *
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+using std::max;
+using std::min;
+
+typedef uint8_t byte;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+size_t strlcpy(char *dst, const char *src, size_t size);
+
+// Pin interrupts and the timers run synchronously from the simulated clock
+#define digitalPinToInterrupt(pin) (pin)
+void attachInterrupt(uint8_t pin, void (*handler)(), int mode);
+
+#define TIM_DIV16 1
+#define TIM_EDGE 0
+#define TIM_SINGLE 0
+void timer1_attachInterrupt(void (*handler)());
+void timer1_enable(uint8_t divider, uint8_t interruptType, uint8_t reload);
+void timer1_write(uint32_t ticks);
+
+// timer0 fires when the cycle counter reaches the value written
+void timer0_isr_init();
+void timer0_attachInterrupt(void (*handler)());
+void timer0_write(uint32_t count);
+
+inline uint32_t xt_rsil(int) { return 0; }
+inline void xt_wsr_ps(uint32_t) {}
+
+class String
+{
+public:
+    String() {}
+    String(const char *str) : value(str ? str : "") {}
+    String(const std::string &str) : value(str) {}
+    explicit String(int number) : value(std::to_string(number)) {}
+    explicit String(unsigned long number) : value(std::to_string(number)) {}
+
+    unsigned int length() const { return value.length(); }
+    const char *c_str() const { return value.c_str(); }
+    char operator[](unsigned int index) const { return value[index]; }
+    bool reserve(unsigned int size)
+    {
+        value.reserve(size);
+        return true;
+    }
+    bool concat(const char *str)
+    {
+        value += str;
+        return true;
+    }
+    bool concat(const char *str, unsigned int length)
+    {
+        value.append(str, length);
+        return true;
+    }
+    bool concat(char c)
+    {
+        value += c;
+        return true;
+    }
+    String &operator+=(const String &other)
+    {
+        value += other.value;
+        return *this;
+    }
+    bool endsWith(const char *suffix) const
+    {
+        size_t n = strlen(suffix);
+        return value.size() >= n && value.compare(value.size() - n, n, suffix) == 0;
+    }
+    bool operator==(const String &other) const { return value == other.value; }
+
+    friend String operator+(const String &a, const String &b) { return String(a.value + b.value); }
+    friend String operator+(const char *a, const String &b) { return String(a + b.value); }
+
+private:
+    std::string value;
+};
+
+// ArduinoJson's String adapter expects this to exist
+class StringSumHelper : public String
+{
+public:
+    using String::String;
+};
+
+class Stream
+{
+public:
+    virtual ~Stream() {}
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) = 0;
+};
+
+class HardwareSerial
+{
+public:
+    void begin(unsigned long) {}
+    size_t print(const char *str) { return fputs(str, stdout); }
+    size_t println(const char *str) { return printf("%s\n", str); }
+    template <typename... Args>
+    size_t printf(const char *format, Args... args) { return ::printf(format, args...); }
+};
+
+extern HardwareSerial Serial;
+
+class EspClass
+{
+public:
+    void restart() {}
+    uint32_t getFreeSketchSpace() { return 1024 * 1024; }
+    uint8_t getCpuFreqMHz() { return 80; }
+    uint32_t getCycleCount() { return micros() * 80; }
+    rst_info *getResetInfoPtr();
+
+    // offset in 4-byte blocks, size in bytes, as the core takes them
+    bool rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size);
+    bool rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size);
+};
+
+extern EspClass ESP;
+
+// Simulation controls and counters
+namespace sim
+{
+    void advanceMicros(unsigned long us);
+    void setPin(uint8_t pin, int level);
+    uint32_t gpioInputs();
+    extern unsigned long pinWrites;
+
+    // Called as millis() reads the clock, before the time is returned. Lets
+    // a test land an interrupt between two steps of the code under test.
+    extern void (*onMillis)();
+
+    // RTC user memory, kept across a simulated reset
+    extern volatile uint32_t rtcUserMemory[128];
+
+    // Why the last simulated reset happened, and the RTC timer's tick period
+    // in us, Q12
+    extern uint32_t resetReason;
+    extern uint32_t rtcPeriod;
+
+    // GPIO set/clear registers, written with a pin mask
+    struct GpioOutRegister
+    {
+        int level;
+        void operator=(uint32_t mask) const;
+    };
+}
+
+extern const sim::GpioOutRegister GPOS;
+extern const sim::GpioOutRegister GPOC;
+#define GPI (sim::gpioInputs())
+#define RTC_USER_MEM (sim::rtcUserMemory)
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Simulated emulated-EEPROM sector. Like the ESP8266 core, a commit rewrites
+// the whole buffer when anything changed.
+class EEPROMClass
+{
+public:
+    void begin(size_t size);
+    uint8_t read(int address) const { return data[address]; }
+    void write(int address, uint8_t value);
+    bool commit();
+    size_t length() const { return size; }
+    uint8_t *getDataPtr()
+    {
+        dirty = true;
+        return data;
+    }
+    const uint8_t *getConstDataPtr() const { return data; }
+
+    template <typename T>
+    T &get(int address, T &value)
+    {
+        memcpy(&value, data + address, sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    const T &put(int address, const T &value)
+    {
+        if (memcmp(data + address, &value, sizeof(T)) != 0)
+        {
+            memcpy(data + address, &value, sizeof(T));
+            dirty = true;
+        }
+        return value;
+    }
+
+    unsigned long bytesCommitted = 0;
+
+private:
+    uint8_t data[4096] = {};
+    size_t size = 0;
+    bool dirty = false;
+};
+
+extern EEPROMClass EEPROM;
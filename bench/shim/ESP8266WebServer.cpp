@@ -0,0 +1,477 @@
+#include <ESP8266WebServer.h>
+#include <Updater.h>
+#include <strings.h>
+
+ESP8266WiFiClass WiFi;
+UpdaterClass Update;
+
+// lwIP's TCP_SND_BUF, two segments in flight before a write has to wait
+#define SIM_TCP_SEND_BUFFER 2920
+
+static const char *methodNames[] = {"ANY", "GET", "HEAD", "POST", "PUT", "PATCH", "DELETE", "OPTIONS"};
+
+namespace sim
+{
+    AccessPoint accessPoint;
+    StationLog station;
+    FlashUpdate flashUpdate;
+
+    unsigned long netRoundTrip = 3000;
+    unsigned long requestCpuTime = 4000;
+    size_t freeHeap = 20000;
+
+    static std::vector<HttpClient *> backlog;
+
+    void connectClient(HttpClient *client)
+    {
+        backlog.push_back(client);
+    }
+
+    void resetNetwork()
+    {
+        backlog.clear();
+    }
+
+    // The connection that has been waiting longest, like the accept queue
+    static HttpClient *acceptClient()
+    {
+        auto oldest = backlog.end();
+        for (auto it = backlog.begin(); it != backlog.end(); ++it)
+        {
+            if ((long)(micros() - (*it)->start) >= 0 && (oldest == backlog.end() || (*it)->start < (*oldest)->start))
+            {
+                oldest = it;
+            }
+        }
+        if (oldest == backlog.end())
+        {
+            return nullptr;
+        }
+        HttpClient *client = *oldest;
+        backlog.erase(oldest);
+        return client;
+    }
+
+    static size_t arrived(const HttpClient &client)
+    {
+        if ((long)(micros() - client.start) < 0)
+        {
+            return 0;
+        }
+        if (client.byteGap == 0)
+        {
+            return client.request.size();
+        }
+        return min(client.request.size(), (size_t)((micros() - client.start) / client.byteGap + 1));
+    }
+
+    static unsigned long arrival(const HttpClient &client, size_t position)
+    {
+        return client.start + position * client.byteGap;
+    }
+}
+
+ESP8266WebServer::ESP8266WebServer(int) : started(false),
+                                           connection(nullptr),
+                                           clientStatus(CLIENT_NONE),
+                                           statusChange(0),
+                                           readPosition(0),
+                                           requestMethod(HTTP_ANY),
+                                           contentLength(0)
+{
+}
+
+void ESP8266WebServer::on(const char *uri, HTTPMethod method, THandlerFunction handler)
+{
+    routes.push_back({uri, method, handler, nullptr});
+}
+
+void ESP8266WebServer::on(const char *uri, HTTPMethod method, THandlerFunction handler, THandlerFunction upload)
+{
+    routes.push_back({uri, method, handler, upload});
+}
+
+String ESP8266WebServer::arg(const char *name) const
+{
+    for (const auto &arg : args)
+    {
+        if (arg.first == name)
+        {
+            return String(arg.second);
+        }
+    }
+    return String();
+}
+
+bool ESP8266WebServer::hasArg(const char *name) const
+{
+    for (const auto &arg : args)
+    {
+        if (arg.first == name)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ESP8266WebServer::handleClient()
+{
+    if (!started)
+    {
+        return;
+    }
+
+    if (clientStatus == CLIENT_NONE)
+    {
+        connection = sim::acceptClient();
+        if (!connection)
+        {
+            return;
+        }
+        clientStatus = CLIENT_WAIT_READ;
+        statusChange = millis();
+        readPosition = 0;
+    }
+
+    // Nothing was sent back, the client waits until the server gives up
+    if (clientStatus == CLIENT_WAIT_CLOSE)
+    {
+        if (millis() - statusChange > HTTP_MAX_CLOSE_WAIT)
+        {
+            closeClient();
+        }
+        return;
+    }
+
+    if (available() == 0)
+    {
+        if (millis() - statusChange > HTTP_MAX_DATA_WAIT)
+        {
+            closeClient();
+        }
+        return;
+    }
+
+    // From the first byte on, the request is read to the end before
+    // handleClient() returns
+    sim::advanceMicros(sim::requestCpuTime);
+    if (!parseRequest())
+    {
+        closeClient();
+        return;
+    }
+
+    contentLength = SIZE_MAX;
+    extraHeaders.clear();
+    for (const auto &hook : hooks)
+    {
+        hook(String(methodNames[requestMethod]), String(requestUri), nullptr, [](const String &type)
+             { return type; });
+    }
+
+    bool handled = false;
+    for (const auto &route : routes)
+    {
+        if (route.uri == requestUri && (route.method == HTTP_ANY || route.method == requestMethod))
+        {
+            if (route.upload && !connection->uploadChunks.empty())
+            {
+                runUpload(route);
+                if (connection->uploadAborted)
+                {
+                    closeClient();
+                    return;
+                }
+            }
+            route.handler();
+            handled = true;
+            break;
+        }
+    }
+    if (!handled && notFound)
+    {
+        notFound();
+    }
+
+    if (connection->status != 0)
+    {
+        closeClient();
+    }
+    else
+    {
+        clientStatus = CLIENT_WAIT_CLOSE;
+        statusChange = millis();
+    }
+}
+
+size_t ESP8266WebServer::available() const
+{
+    return connection->stopped ? 0 : sim::arrived(*connection) - readPosition;
+}
+
+// Spins on yield() until the next byte is in or `timeout` us have gone, as
+// the core's reads do. The client's own timeout is read again on every
+// pass, a stopped connection has nothing more to read.
+bool ESP8266WebServer::waitForByte(unsigned long timeout)
+{
+    unsigned long start = micros();
+    while (available() == 0)
+    {
+        unsigned long waited = micros() - start;
+        timeout = min(timeout, connection->timeout * 1000UL);
+        if (waited >= timeout)
+        {
+            return false;
+        }
+        unsigned long step = min(1000UL, timeout - waited);
+        if (!connection->stopped && readPosition < connection->request.size())
+        {
+            step = min(step, sim::arrival(*connection, readPosition) - micros());
+        }
+        sim::advanceMicros(step);
+        yield();
+    }
+    return true;
+}
+
+// Stream::timedRead(), the wait starts over for every byte
+int ESP8266WebServer::timedRead()
+{
+    if (!waitForByte(HTTP_MAX_SEND_WAIT * 1000UL))
+    {
+        return -1;
+    }
+    return (uint8_t)connection->request[readPosition++];
+}
+
+// readStringUntil('\r') then readStringUntil('\n'), as the core reads lines
+bool ESP8266WebServer::readLine(std::string &line)
+{
+    line.clear();
+    int c;
+    while ((c = timedRead()) >= 0 && c != '\r')
+    {
+        line += (char)c;
+    }
+    return c >= 0 && timedRead() == '\n';
+}
+
+bool ESP8266WebServer::parseRequest()
+{
+    std::string line;
+    if (!readLine(line))
+    {
+        return false;
+    }
+
+    size_t methodEnd = line.find(' ');
+    size_t uriEnd = line.find(' ', methodEnd + 1);
+    if (methodEnd == std::string::npos || uriEnd == std::string::npos)
+    {
+        return false;
+    }
+
+    std::string methodName = line.substr(0, methodEnd);
+    requestMethod = HTTP_ANY;
+    for (int i = HTTP_GET; i <= HTTP_OPTIONS; i++)
+    {
+        if (methodName == methodNames[i])
+        {
+            requestMethod = (HTTPMethod)i;
+        }
+    }
+
+    std::string url = line.substr(methodEnd + 1, uriEnd - methodEnd - 1);
+    size_t query = url.find('?');
+    requestUri = url.substr(0, query);
+    args.clear();
+    if (query != std::string::npos)
+    {
+        parseArgs(url.substr(query + 1));
+    }
+
+    size_t bodyLength = 0;
+    authorization.clear();
+    while (true)
+    {
+        if (!readLine(line))
+        {
+            return false;
+        }
+        if (line.empty())
+        {
+            break;
+        }
+        size_t colon = line.find(':');
+        if (colon == std::string::npos)
+        {
+            continue;
+        }
+        std::string name = line.substr(0, colon);
+        size_t value = line.find_first_not_of(' ', colon + 1);
+        if (strcasecmp(name.c_str(), "Content-Length") == 0)
+        {
+            bodyLength = strtoul(line.c_str() + colon + 1, nullptr, 10);
+        }
+        else if (strcasecmp(name.c_str(), "Authorization") == 0 && value != std::string::npos)
+        {
+            authorization = line.substr(value);
+        }
+    }
+
+    if (bodyLength == 0)
+    {
+        return true;
+    }
+
+    // The core allocates the whole body before reading it, and waits up to
+    // HTTP_MAX_POST_WAIT for each piece of it
+    if (bodyLength > sim::freeHeap)
+    {
+        return false;
+    }
+
+    std::string body;
+    while (body.size() < bodyLength)
+    {
+        if (!waitForByte(HTTP_MAX_POST_WAIT * 1000UL))
+        {
+            return false;
+        }
+        size_t n = min(available(), bodyLength - body.size());
+        body.append(connection->request, readPosition, n);
+        readPosition += n;
+    }
+    args.push_back({"plain", body});
+    return true;
+}
+
+// As the core's multipart parser calls it: start, a write per chunk, then
+// the end, or an abort when the connection drops
+void ESP8266WebServer::runUpload(const Route &route)
+{
+    currentUpload.filename = "firmware.bin";
+    currentUpload.currentSize = 0;
+    currentUpload.status = UPLOAD_FILE_START;
+    route.upload();
+
+    for (const std::string &chunk : connection->uploadChunks)
+    {
+        currentUpload.currentSize = min(chunk.size(), sizeof(currentUpload.buf));
+        memcpy(currentUpload.buf, chunk.data(), currentUpload.currentSize);
+        currentUpload.status = UPLOAD_FILE_WRITE;
+        route.upload();
+    }
+
+    currentUpload.currentSize = 0;
+    currentUpload.status = connection->uploadAborted ? UPLOAD_FILE_ABORTED : UPLOAD_FILE_END;
+    route.upload();
+}
+
+static std::string base64(const std::string &text)
+{
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string encoded;
+    for (size_t i = 0; i < text.size(); i += 3)
+    {
+        uint32_t group = (uint8_t)text[i] << 16;
+        group |= i + 1 < text.size() ? (uint8_t)text[i + 1] << 8 : 0;
+        group |= i + 2 < text.size() ? (uint8_t)text[i + 2] : 0;
+        encoded += digits[group >> 18 & 63];
+        encoded += digits[group >> 12 & 63];
+        encoded += i + 1 < text.size() ? digits[group >> 6 & 63] : '=';
+        encoded += i + 2 < text.size() ? digits[group & 63] : '=';
+    }
+    return encoded;
+}
+
+bool ESP8266WebServer::authenticate(const char *username, const char *password) const
+{
+    return authorization == "Basic " + base64(std::string(username) + ":" + password);
+}
+
+void ESP8266WebServer::requestAuthentication()
+{
+    sendHeader("WWW-Authenticate", "Basic realm=\"Login Required\"");
+    send(401, "text/html", "");
+}
+
+void ESP8266WebServer::parseArgs(const std::string &query)
+{
+    size_t start = 0;
+    while (start < query.size())
+    {
+        size_t end = query.find('&', start);
+        std::string pair = query.substr(start, end - start);
+        size_t equals = pair.find('=');
+        args.push_back({pair.substr(0, equals), equals == std::string::npos ? "" : pair.substr(equals + 1)});
+        if (end == std::string::npos)
+        {
+            break;
+        }
+        start = end + 1;
+    }
+}
+
+void ESP8266WebServer::send(int code, const char *contentType, const String &content)
+{
+    send_P(code, contentType, content.c_str(), content.length());
+}
+
+void ESP8266WebServer::send_P(int code, PGM_P contentType, PGM_P content, size_t length)
+{
+    char head[128];
+    snprintf(head, sizeof(head), "HTTP/1.1 %d\r\nContent-Type: %s\r\nContent-Length: %zu\r\n", code,
+             contentType, contentLength == SIZE_MAX ? length : contentLength);
+    std::string headers = head + extraHeaders + "Connection: close\r\n\r\n";
+
+    connection->status = code;
+    write(headers.data(), headers.size());
+    write(content, length);
+}
+
+void ESP8266WebServer::sendHeader(const String &name, const String &value, bool)
+{
+    extraHeaders += std::string(name.c_str()) + ": " + value.c_str() + "\r\n";
+}
+
+void ESP8266WebServer::sendContent(const char *content, size_t length)
+{
+    write(content, length);
+}
+
+// Blocks while the bytes beyond the send buffer wait for ACKs
+void ESP8266WebServer::write(const char *data, size_t length)
+{
+    connection->response.append(data, length);
+    sim::advanceMicros(length / SIM_TCP_SEND_BUFFER * sim::netRoundTrip);
+}
+
+uint8_t WiFiClient::connected() const
+{
+    return connection && !connection->stopped && !connection->done;
+}
+
+void WiFiClient::stop()
+{
+    if (connection)
+    {
+        connection->stopped = true;
+    }
+}
+
+void WiFiClient::setTimeout(unsigned long timeout)
+{
+    if (connection)
+    {
+        connection->timeout = timeout;
+    }
+}
+
+void ESP8266WebServer::closeClient()
+{
+    connection->done = micros();
+    connection = nullptr;
+    clientStatus = CLIENT_NONE;
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// The ESP8266 core's web server as far as the firmware uses it, serving
+// simulated clients. It keeps the core's structure: one client at a time,
+// the request read with blocking, timed reads, the handler run, and every
+// wait spent in simulated time with the timer interrupt still firing. Reads
+// wait by spinning on yield(), so scheduled functions run meanwhile.
+
+#define HTTP_MAX_DATA_WAIT 5000  // ms to wait for the client to send the request
+#define HTTP_MAX_POST_WAIT 5000  // ms to wait for POST data to arrive
+#define HTTP_MAX_SEND_WAIT 5000  // ms to wait for each byte of the request
+#define HTTP_MAX_CLOSE_WAIT 2000 // ms to wait for the client to close the connection
+
+enum HTTPMethod
+{
+    HTTP_ANY,
+    HTTP_GET,
+    HTTP_HEAD,
+    HTTP_POST,
+    HTTP_PUT,
+    HTTP_PATCH,
+    HTTP_DELETE,
+    HTTP_OPTIONS
+};
+
+enum HTTPUploadStatus
+{
+    UPLOAD_FILE_START,
+    UPLOAD_FILE_WRITE,
+    UPLOAD_FILE_END,
+    UPLOAD_FILE_ABORTED
+};
+
+struct HTTPUpload
+{
+    HTTPUploadStatus status = UPLOAD_FILE_ABORTED;
+    String filename;
+    size_t currentSize = 0;
+    uint8_t buf[1460];
+};
+
+namespace sim
+{
+    // One connection to the web server. The request arrives from `start`,
+    // one byte every `byteGap` us or all at once for 0. The client closes
+    // the connection as soon as it has the response.
+    struct HttpClient
+    {
+        std::string request;
+        unsigned long start = 0;
+        unsigned long byteGap = 0;
+
+        // A file upload, handed to the route's upload handler a chunk at a
+        // time after the request. Multipart encoding isn't simulated.
+        std::vector<std::string> uploadChunks;
+        bool uploadAborted = false; // The connection drops after the last chunk
+
+        std::string response;
+        bool stopped = false;   // The server called stop(), nothing more arrives
+        unsigned long timeout = HTTP_MAX_SEND_WAIT; // The client's setTimeout(), in ms
+        int status = 0;         // 0 when the server dropped the connection
+        unsigned long done = 0; // When the connection closed, 0 while open
+    };
+
+    // Queues a connection on the listening socket
+    void connectClient(HttpClient *client);
+    void resetNetwork();
+
+    // Cost model, in us. A write blocks for a round trip per full send
+    // buffer, and each request costs the core's TCP stack and request parser
+    // some CPU time on top of the handler.
+    extern unsigned long netRoundTrip;
+    extern unsigned long requestCpuTime;
+    extern size_t freeHeap; // A request body bigger than this can't be buffered
+}
+
+class ESP8266WebServer
+{
+public:
+    typedef std::function<void()> THandlerFunction;
+    typedef std::function<String(const String &)> ContentTypeFunction;
+
+    enum ClientFuture
+    {
+        CLIENT_REQUEST_CAN_CONTINUE,
+        CLIENT_REQUEST_IS_HANDLED,
+        CLIENT_MUST_STOP,
+        CLIENT_IS_GIVEN
+    };
+    typedef std::function<ClientFuture(const String &, const String &, WiFiClient *, ContentTypeFunction)> HookFunction;
+
+    explicit ESP8266WebServer(int port);
+
+    void begin() { started = true; }
+    void handleClient();
+
+    void on(const char *uri, HTTPMethod method, THandlerFunction handler);
+    void on(const char *uri, HTTPMethod method, THandlerFunction handler, THandlerFunction uploadHandler);
+    void onNotFound(THandlerFunction handler) { notFound = handler; }
+    void addHook(HookFunction hook) { hooks.push_back(hook); }
+
+    String uri() const { return String(requestUri); }
+    HTTPMethod method() const { return requestMethod; }
+    String arg(const char *name) const;
+    bool hasArg(const char *name) const;
+    HTTPUpload &upload() { return currentUpload; }
+    WiFiClient client() { return WiFiClient(connection); }
+
+    // HTTP basic auth
+    bool authenticate(const char *username, const char *password) const;
+    void requestAuthentication();
+
+    void send(int code, const char *contentType, const String &content);
+    void send_P(int code, PGM_P contentType, PGM_P content, size_t length);
+    void sendHeader(const String &name, const String &value, bool first = false);
+    void setContentLength(size_t length) { contentLength = length; }
+    void sendContent(const char *content, size_t length);
+
+private:
+    struct Route
+    {
+        std::string uri;
+        HTTPMethod method;
+        THandlerFunction handler;
+        THandlerFunction upload;
+    };
+
+    enum ClientStatus
+    {
+        CLIENT_NONE,
+        CLIENT_WAIT_READ,
+        CLIENT_WAIT_CLOSE
+    };
+
+    bool started;
+    std::vector<Route> routes;
+    THandlerFunction notFound;
+    std::vector<HookFunction> hooks;
+
+    sim::HttpClient *connection;
+    ClientStatus clientStatus;
+    unsigned long statusChange; // millis
+    size_t readPosition;
+
+    HTTPMethod requestMethod;
+    std::string requestUri;
+    std::vector<std::pair<std::string, std::string>> args;
+    std::string extraHeaders;
+    std::string authorization;
+    size_t contentLength;
+    HTTPUpload currentUpload;
+
+    size_t available() const;
+    bool waitForByte(unsigned long timeout);
+    int timedRead();
+    bool readLine(std::string &line);
+    bool parseRequest();
+    void parseArgs(const std::string &query);
+    void runUpload(const Route &route);
+    void write(const char *data, size_t length);
+    void closeClient();
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Station and the one access point it can reach. With the defaults the
+// station associates as soon as begin() is called, so the web server starts
+// on the first WiFiManager::update().
+
+class IPAddress
+{
+public:
+    IPAddress() : address(0) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+        : address(a | b << 8 | c << 16 | (uint32_t)d << 24) {}
+
+    bool isSet() const { return address != 0; }
+
+    String toString() const
+    {
+        char text[16];
+        snprintf(text, sizeof(text), "%u.%u.%u.%u", address & 0xFF, address >> 8 & 0xFF,
+                 address >> 16 & 0xFF, address >> 24);
+        return String(text);
+    }
+
+private:
+    uint32_t address;
+};
+
+#define INADDR_ANY IPAddress()
+
+enum WiFiMode_t
+{
+    WIFI_OFF,
+    WIFI_STA
+};
+
+enum wl_status_t
+{
+    WL_IDLE_STATUS,
+    WL_CONNECTED = 3,
+    WL_DISCONNECTED = 6
+};
+
+namespace sim
+{
+    struct HttpClient;
+}
+
+// The web server's current connection
+class WiFiClient
+{
+public:
+    explicit WiFiClient(sim::HttpClient *connection = nullptr) : connection(connection) {}
+    uint8_t connected() const;
+    void stop();
+    void setTimeout(unsigned long timeout);
+
+private:
+    sim::HttpClient *connection;
+};
+
+namespace sim
+{
+    // A begin() given a BSSID and channel only finds the AP while both
+    // still match
+    struct AccessPoint
+    {
+        bool up = true;
+        uint8_t bssid[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+        int32_t channel = 6;
+        unsigned long scanTime = 0;   // us from begin() to associated after a scan
+        unsigned long directTime = 0; // The same, straight to the BSSID and channel
+    };
+
+    // What the firmware asked the station for
+    struct StationLog
+    {
+        int begins = 0;
+        bool direct = false; // The last begin() gave a BSSID and channel
+        int32_t channel = 0;
+        bool staticIp = false; // config() was given an address
+    };
+
+    extern AccessPoint accessPoint;
+    extern StationLog station;
+}
+
+class ESP8266WiFiClass
+{
+public:
+    void persistent(bool) {}
+    void setAutoReconnect(bool) {}
+    void mode(WiFiMode_t) {}
+    void config(IPAddress ip, IPAddress, IPAddress, IPAddress = IPAddress()) { sim::station.staticIp = ip.isSet(); }
+    void begin(const char *, const char *, int32_t channel = 0, const uint8_t *bssid = nullptr)
+    {
+        sim::station.begins++;
+        sim::station.direct = bssid != nullptr;
+        sim::station.channel = channel;
+        memcpy(target, bssid ? bssid : sim::accessPoint.bssid, sizeof(target));
+        targetChannel = bssid ? channel : sim::accessPoint.channel;
+        beginTime = micros();
+        associating = true;
+    }
+    void disconnect() { associating = false; }
+    wl_status_t status() const
+    {
+        const sim::AccessPoint &ap = sim::accessPoint;
+        bool found = ap.up && memcmp(target, ap.bssid, sizeof(target)) == 0 && targetChannel == ap.channel;
+        unsigned long wait = sim::station.direct ? ap.directTime : ap.scanTime;
+        return associating && found && micros() - beginTime >= wait ? WL_CONNECTED : WL_DISCONNECTED;
+    }
+    uint8_t *BSSID() { return sim::accessPoint.bssid; }
+    int32_t channel() const { return sim::accessPoint.channel; }
+    IPAddress localIP() const { return IPAddress(192, 168, 1, 50); }
+    IPAddress gatewayIP() const { return IPAddress(192, 168, 1, 1); }
+    IPAddress subnetMask() const { return IPAddress(255, 255, 255, 0); }
+    IPAddress dnsIP() const { return IPAddress(192, 168, 1, 1); }
+    int32_t RSSI() const { return -60; }
+
+    static void preinitWiFiOff() {}
+
+private:
+    bool associating = false;
+    uint8_t target[6] = {};
+    int32_t targetChannel = 0;
+    unsigned long beginTime = 0;
+};
+
+extern ESP8266WiFiClass WiFi;
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <functional>
+#include <stdint.h>
+
+// The core's recurrent scheduled functions. They run from yield(), which
+// blocking waits spin on, at most every repeat_us, and are dropped once
+// they return false.
+bool schedule_recurrent_function_us(const std::function<bool(void)> &fn, uint32_t repeat_us,
+                                    const std::function<bool(void)> &alarm = nullptr);
+
+namespace sim
+{
+    // Objects that scheduled a function don't outlive a test
+    void clearSchedule();
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Arduino.h>
+
+namespace sim
+{
+    // The OTA partition. Writes past `space` bytes come up short, as a
+    // failing flash write does.
+    struct FlashUpdate
+    {
+        size_t space = 1 << 20;
+        bool md5Matches = true;
+
+        // What the firmware did with it
+        bool open = false;
+        size_t written = 0;
+        bool finished = false; // Verified and marked bootable
+        bool aborted = false;
+    };
+
+    extern FlashUpdate flashUpdate;
+}
+
+class UpdaterClass
+{
+public:
+    bool begin(size_t)
+    {
+        sim::flashUpdate.open = true;
+        sim::flashUpdate.written = 0;
+        return true;
+    }
+
+    bool setMD5(const char *md5) { return strlen(md5) == 32; }
+
+    size_t write(const uint8_t *, size_t length)
+    {
+        sim::FlashUpdate &update = sim::flashUpdate;
+        size_t n = update.open ? min(length, update.space - min(update.space, update.written)) : 0;
+        update.written += n;
+        return n;
+    }
+
+    // Without evenIfRemaining an update of unknown size is abandoned
+    bool end(bool evenIfRemaining = false)
+    {
+        sim::FlashUpdate &update = sim::flashUpdate;
+        if (!update.open)
+        {
+            return false;
+        }
+        update.open = false;
+        if (!evenIfRemaining)
+        {
+            update.aborted = true;
+            return false;
+        }
+        update.finished = update.md5Matches;
+        return update.finished;
+    }
+};
+
+extern UpdaterClass Update;
@@ -0,0 +1,298 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <Adafruit_LEDBackpack.h>
+#include <Schedule.h>
+#include <vector>
+
+HardwareSerial Serial;
+EspClass ESP;
+EEPROMClass EEPROM;
+unsigned long Adafruit_AlphaNum4::i2cBytes = 0;
+uint16_t Adafruit_AlphaNum4::shown[8] = {};
+
+const sim::GpioOutRegister GPOS = {HIGH};
+const sim::GpioOutRegister GPOC = {LOW};
+
+#define SIM_FLASH_COMMIT_US 30000
+
+static unsigned long simMicros = 0;
+static int pinLevels[32];
+static void (*pinHandlers[32])();
+
+struct SimTimer
+{
+    void (*handler)();
+    bool armed;
+    unsigned long deadline;
+};
+
+static SimTimer timer0;
+static SimTimer timer1;
+
+// The armed timer due first, if one is due by target
+static SimTimer *dueTimer(unsigned long target)
+{
+    SimTimer *due = nullptr;
+    if (timer0.armed && (long)(target - timer0.deadline) >= 0)
+    {
+        due = &timer0;
+    }
+    if (timer1.armed && (long)(target - timer1.deadline) >= 0 &&
+        (!due || (long)(timer1.deadline - due->deadline) < 0))
+    {
+        due = &timer1;
+    }
+    return due;
+}
+
+namespace sim
+{
+    unsigned long pinWrites = 0;
+    void (*onMillis)() = nullptr;
+    volatile uint32_t rtcUserMemory[128];
+    uint32_t resetReason = REASON_DEFAULT_RST;
+    uint32_t rtcPeriod = 27307; // About 150 kHz
+
+    // Fires the timers at their exact deadlines on the way to the new time,
+    // the earlier one first
+    void advanceMicros(unsigned long us)
+    {
+        unsigned long target = simMicros + us;
+        SimTimer *timer;
+        while ((timer = dueTimer(target)))
+        {
+            simMicros = timer->deadline;
+            timer->armed = false;
+            timer->handler();
+        }
+        simMicros = target;
+    }
+
+    void setPin(uint8_t pin, int level)
+    {
+        bool changed = pinLevels[pin] != level;
+        pinLevels[pin] = level;
+        if (changed && pinHandlers[pin])
+        {
+            pinHandlers[pin]();
+        }
+    }
+
+    uint32_t gpioInputs()
+    {
+        uint32_t levels = 0;
+        for (int pin = 0; pin < 32; pin++)
+        {
+            levels |= (uint32_t)(pinLevels[pin] & 1) << pin;
+        }
+        return levels;
+    }
+
+    void GpioOutRegister::operator=(uint32_t mask) const
+    {
+        for (int pin = 0; pin < 32; pin++)
+        {
+            if (mask & (1u << pin))
+            {
+                digitalWrite(pin, level);
+            }
+        }
+    }
+}
+
+unsigned long millis()
+{
+    if (sim::onMillis)
+    {
+        sim::onMillis();
+    }
+    return simMicros / 1000;
+}
+unsigned long micros() { return simMicros; }
+void delay(unsigned long ms) { sim::advanceMicros(ms * 1000); }
+void delayMicroseconds(unsigned int us) { sim::advanceMicros(us); }
+
+namespace sim
+{
+    struct Recurrent
+    {
+        std::function<bool(void)> fn;
+        uint32_t repeat;
+        unsigned long last;
+    };
+    static std::vector<Recurrent> recurrent;
+    static bool inRecurrent = false;
+
+    void clearSchedule()
+    {
+        recurrent.clear();
+    }
+}
+
+bool schedule_recurrent_function_us(const std::function<bool(void)> &fn, uint32_t repeat_us,
+                                    const std::function<bool(void)> &)
+{
+    sim::recurrent.push_back({fn, repeat_us, micros()});
+    return true;
+}
+
+void yield()
+{
+    if (sim::inRecurrent)
+    {
+        return;
+    }
+    sim::inRecurrent = true;
+    for (size_t i = 0; i < sim::recurrent.size();)
+    {
+        sim::Recurrent &entry = sim::recurrent[i];
+        if (micros() - entry.last < entry.repeat)
+        {
+            i++;
+            continue;
+        }
+        entry.last = micros();
+        if (entry.fn())
+        {
+            i++;
+        }
+        else
+        {
+            sim::recurrent.erase(sim::recurrent.begin() + i);
+        }
+    }
+    sim::inRecurrent = false;
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    if (mode == INPUT_PULLUP)
+    {
+        pinLevels[pin] = HIGH;
+    }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    pinLevels[pin] = value;
+    sim::pinWrites++;
+}
+
+int digitalRead(uint8_t pin)
+{
+    return pinLevels[pin];
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(), int)
+{
+    pinHandlers[pin] = handler;
+}
+
+void timer1_attachInterrupt(void (*handler)())
+{
+    timer1.handler = handler;
+}
+
+void timer1_enable(uint8_t, uint8_t, uint8_t) {}
+
+// TIM_DIV16 runs at 5 ticks per us
+void timer1_write(uint32_t ticks)
+{
+    timer1.deadline = simMicros + ticks / 5;
+    timer1.armed = true;
+}
+
+void timer0_isr_init() {}
+
+void timer0_attachInterrupt(void (*handler)())
+{
+    timer0.handler = handler;
+}
+
+// The cycle counter runs at 80 per us
+void timer0_write(uint32_t count)
+{
+    timer0.deadline = simMicros + (count - ESP.getCycleCount()) / 80;
+    timer0.armed = true;
+}
+
+rst_info *EspClass::getResetInfoPtr()
+{
+    static rst_info info;
+    info.reason = sim::resetReason;
+    return &info;
+}
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size)
+{
+    if (offset * 4 + size > sizeof(sim::rtcUserMemory))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < size / 4; i++)
+    {
+        data[i] = sim::rtcUserMemory[offset + i];
+    }
+    return true;
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size)
+{
+    if (offset * 4 + size > sizeof(sim::rtcUserMemory))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < size / 4; i++)
+    {
+        sim::rtcUserMemory[offset + i] = data[i];
+    }
+    return true;
+}
+
+uint32_t system_get_rtc_time()
+{
+    return ((uint64_t)simMicros << 12) / sim::rtcPeriod;
+}
+
+uint32_t system_rtc_clock_cali_proc()
+{
+    return sim::rtcPeriod;
+}
+
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t length = strlen(src);
+    if (size > 0)
+    {
+        size_t n = length < size - 1 ? length : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return length;
+}
+
+void EEPROMClass::begin(size_t newSize)
+{
+    size = newSize;
+}
+
+void EEPROMClass::write(int address, uint8_t value)
+{
+    if (data[address] != value)
+    {
+        data[address] = value;
+        dirty = true;
+    }
+}
+
+// Erasing and rewriting the sector stalls the CPU, the timer still fires
+bool EEPROMClass::commit()
+{
+    if (dirty)
+    {
+        bytesCommitted += size;
+        dirty = false;
+        sim::advanceMicros(SIM_FLASH_COMMIT_US);
+    }
+    return true;
+}
@@ -1,4 +1,5 @@
 let patches = [];
+let savedBrightness = null;
 
 async function loadPatches() {
     try {
@@ -16,12 +17,13 @@ function renderPatches() {
         .filter(patch => patch.name !== '')
         .map((patch, index) => `
             <div class="patch" draggable="true" data-index="${index}">
-                <span class="patch-handle material-icons">drag_indicator</span>
+                <span class="patch-handle"><svg class="icon" viewBox="0 0 24 24"><path d="M11 18c0 1.1-.9 2-2 2s-2-.9-2-2 .9-2 2-2 2 .9 2 2zm-2-8c-1.1 0-2 .9-2 2s.9 2 2 2 2-.9 2-2-.9-2-2-2zm0-6c-1.1 0-2 .9-2 2s.9 2 2 2 2-.9 2-2-.9-2-2-2zm6 4c1.1 0 2-.9 2-2s-.9-2-2-2-2 .9-2 2 .9 2 2 2zm0 2c-1.1 0-2 .9-2 2s.9 2 2 2 2-.9 2-2-.9-2-2-2zm0 6c-1.1 0-2 .9-2 2s.9 2 2 2 2-.9 2-2-.9-2-2-2z"/></svg></span>
                 <input type="text" value="${patch.name}" maxlength="4" 
                        pattern="[A-Za-z0-9 ]{1,4}"
                        onchange="updatePatch(${index}, 'name', this.value)">
                 <input type="number" value="${patch.tempo}" min="40" max="240"
                        onchange="updatePatch(${index}, 'tempo', this.value)">
+                ${renderCurve(patch, index)}
                 <button class="delete-btn" onclick="deletePatch(${index})">Delete</button>
             </div>
         `).join('');
@@ -29,6 +31,38 @@ function renderPatches() {
     setupDragAndDrop();
 }
 
+// Practice ramp from the patch tempo, absent for a flat patch
+function curveOf(patch) {
+    return patch.curve || { type: 'none', end: Math.min(patch.tempo + 20, 240), bars: 4, step: 5 };
+}
+
+function renderCurve(patch, index) {
+    const curve = curveOf(patch);
+    const types = ['none', 'linear', 'step']
+        .map(type => `<option ${curve.type === type ? 'selected' : ''}>${type}</option>`).join('');
+    let fields = '';
+    if (curve.type !== 'none') {
+        fields = `
+            <input type="number" value="${curve.end}" min="40" max="240" title="End tempo"
+                   onchange="updateCurve(${index}, 'end', this.value)">
+            <input type="number" value="${curve.bars}" min="1" max="255" title="Bars per step, or for the whole sweep"
+                   onchange="updateCurve(${index}, 'bars', this.value)">`;
+    }
+    if (curve.type === 'step') {
+        fields += `
+            <input type="number" value="${curve.step}" min="-127" max="127" title="BPM per step"
+                   onchange="updateCurve(${index}, 'step', this.value)">`;
+    }
+    return `<select title="Tempo ramp" onchange="updateCurve(${index}, 'type', this.value)">${types}</select>${fields}`;
+}
+
+async function updateCurve(index, field, value) {
+    const curve = { ...curveOf(patches[index]) };
+    curve[field] = field === 'type' ? value : parseInt(value);
+    await updatePatch(index, 'curve', curve.type === 'none' ? undefined : curve);
+    renderPatches();
+}
+
 async function createPatch() {
     const nameInput = document.getElementById('new-patch-name');
     const tempoInput = document.getElementById('new-patch-tempo');
@@ -52,6 +86,8 @@ async function createPatch() {
             nameInput.value = '';
             tempoInput.value = '';
             showMessage('Patch created', 'success');
+        } else {
+            showMessage('Error creating patch: ' + await errorText(response), 'error');
         }
     } catch (error) {
         showMessage('Error creating patch: ' + error.message, 'error');
@@ -60,7 +96,11 @@ async function createPatch() {
 
 async function updatePatch(index, field, value) {
     const patch = patches[index];
-    patch[field] = field === 'tempo' ? parseInt(value) : value;
+    const newValue = field === 'tempo' ? parseInt(value) : value;
+    if (patch[field] === newValue) {
+        return;
+    }
+    patch[field] = newValue;
 
     try {
         const response = await fetch('/api/patches', {
@@ -71,6 +111,9 @@ async function updatePatch(index, field, value) {
 
         if (response.ok) {
             showMessage('Patch updated', 'success');
+        } else {
+            showMessage('Error updating patch: ' + await errorText(response), 'error');
+            loadPatches();
         }
     } catch (error) {
         showMessage('Error updating patch: ' + error.message, 'error');
@@ -91,6 +134,9 @@ async function deletePatch(index) {
         if (response.ok) {
             await loadPatches();
             showMessage('Patch deleted', 'success');
+        } else {
+            showMessage('Error deleting patch: ' + await errorText(response), 'error');
+            loadPatches();
         }
     } catch (error) {
         showMessage('Error deleting patch: ' + error.message, 'error');
@@ -147,6 +193,7 @@ async function loadSettings() {
     try {
         const response = await fetch('/api/settings');
         const settings = await response.json();
+        savedBrightness = settings.brightness;
         document.getElementById('brightness').value = settings.brightness;
         document.getElementById('brightness-value').textContent = settings.brightness;
     } catch (error) {
@@ -158,6 +205,10 @@ async function saveSettings() {
     const settings = {
         brightness: parseInt(document.getElementById('brightness').value)
     };
+    if (settings.brightness === savedBrightness) {
+        showMessage('Settings saved', 'success');
+        return;
+    }
 
     try {
         const response = await fetch('/api/settings', {
@@ -167,13 +218,26 @@ async function saveSettings() {
         });
 
         if (response.ok) {
+            savedBrightness = settings.brightness;
             showMessage('Settings saved', 'success');
+        } else {
+            showMessage('Error saving settings: ' + await errorText(response), 'error');
         }
     } catch (error) {
         showMessage('Error saving settings: ' + error.message, 'error');
     }
 }
 
+// Changes are answered 202 once the pedal has queued them, and with an error
+// when it refused them (409 when they no longer fit the patch table)
+async function errorText(response) {
+    try {
+        return (await response.json()).error || response.statusText;
+    } catch (error) {
+        return response.statusText;
+    }
+}
+
 function showMessage(text, type) {
     const messageEl = document.getElementById('message');
     messageEl.textContent = text;
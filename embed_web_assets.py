@@ -0,0 +1,85 @@
+Import("env")
+import gzip
+import os
+import re
+
+# Bundles data/index.html, styles.css and app.js into one minified, gzipped
+# page and writes it to include/web_assets.h as a PROGMEM array, so the web
+# UI ships inside the firmware image
+
+project_dir = env.subst("$PROJECT_DIR")
+data_dir = os.path.join(project_dir, "data")
+output_path = os.path.join(project_dir, "include", "web_assets.h")
+
+
+def read(name):
+    with open(os.path.join(data_dir, name), encoding="utf-8") as f:
+        return f.read()
+
+
+def minify_css(css):
+    css = re.sub(r"/\*.*?\*/", "", css, flags=re.S)
+    css = re.sub(r"\s+", " ", css)
+    # In a selector the space in "a :hover" is a descendant combinator, so
+    # only declaration blocks (the text just before a "}") lose it around ":"
+    parts = re.split(r"([{}])", css)
+    for i in range(0, len(parts), 2):
+        declarations = i + 1 < len(parts) and parts[i + 1] == "}"
+        separators = r"\s*([:;,>])\s*" if declarations else r"\s*([;,>])\s*"
+        parts[i] = re.sub(separators, r"\1", parts[i]).strip()
+    return "".join(parts).replace(";}", "}")
+
+
+def minify_js(js):
+    # Conservative: only indentation, blank lines and whole-line comments go
+    lines = (line.strip() for line in js.splitlines())
+    return "\n".join(line for line in lines if line and not line.startswith("//"))
+
+
+def minify_html(html):
+    html = re.sub(r"<!--.*?-->", "", html, flags=re.S)
+    html = re.sub(r"\s+", " ", html)
+    return re.sub(r">\s+<", "><", html).strip()
+
+
+def bundle():
+    html = minify_html(read("index.html"))
+    html = re.sub(r'<link rel="stylesheet" href="styles.css" ?/?>',
+                  lambda _: "<style>" + minify_css(read("styles.css")) + "</style>", html)
+    html = re.sub(r'<script src="app.js"></script>',
+                  lambda _: "<script>" + minify_js(read("app.js")) + "</script>", html)
+    return gzip.compress(html.encode("utf-8"), compresslevel=9, mtime=0)
+
+
+def write_header(data):
+    rows = []
+    for i in range(0, len(data), 16):
+        rows.append("    " + ", ".join(f"0x{b:02x}" for b in data[i:i + 16]) + ",")
+
+    header = "\n".join([
+        "#pragma once",
+        "",
+        "// Generated by embed_web_assets.py from data/, do not edit",
+        "",
+        "#include <Arduino.h>",
+        "",
+        f"constexpr size_t INDEX_HTML_GZ_SIZE = {len(data)};",
+        "",
+        "constexpr uint8_t INDEX_HTML_GZ[] PROGMEM = {",
+        *rows,
+        "};",
+        "",
+    ])
+
+    # Leave the file alone when nothing changed so it doesn't force a rebuild
+    if os.path.exists(output_path):
+        with open(output_path, encoding="utf-8") as f:
+            if f.read() == header:
+                return
+
+    with open(output_path, "w", encoding="utf-8") as f:
+        f.write(header)
+    print(f"Embedded web UI: {len(data)} bytes gzipped")
+
+
+write_header(bundle())
@@ -15,6 +15,10 @@ if os.path.exists(secrets_path):
         f'-DWIFI_PASSWORD=\\"{config["secrets"]["WIFI_PASSWORD"]}\\"',
     ]
 
+    # Firmware updates are refused without one
+    if "OTA_PASSWORD" in config["secrets"]:
+        build_flags.append(f'-DOTA_PASSWORD=\\"{config["secrets"]["OTA_PASSWORD"]}\\"')
+
     # Get existing build flags
     existing_flags = env.get("BUILD_FLAGS", [])
 
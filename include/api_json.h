@@ -0,0 +1,18 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "types.h"
+#include "config.h"
+
+// Every patch with a curve, the worst case
+#define PATCHES_JSON_SIZE (JSON_ARRAY_SIZE(MAX_PATCHES) + MAX_PATCHES * (JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(4)))
+
+// A PUT body, {"index": n, "patch": {...}}, with room for copied strings
+#define PATCH_REQUEST_JSON_SIZE (JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(4) + 96)
+
+// JSON encoding of the /api/patches payloads, shared by the web server and
+// the host benchmarks
+void patchesToJson(const Patch *patches, int count, String &response);
+// Returns false for a tempo the metronome can't play, 40 to 240 BPM
+bool patchFromJson(JsonVariantConst json, Patch &patch);
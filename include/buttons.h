@@ -2,33 +2,66 @@
 
 #include <Arduino.h>
 #include "types.h"
+#include "config.h"
 
+enum ButtonId
+{
+    BUTTON_LEFT,
+    BUTTON_RIGHT,
+    BUTTON_COUNT
+};
+
+enum GestureType : uint8_t
+{
+    GESTURE_NONE,
+    GESTURE_PRESS,  // Leading edge, reported with no added latency
+    GESTURE_CLICK,  // Released before HOLD_THRESHOLD
+    GESTURE_LONG,   // Held for HOLD_THRESHOLD
+    GESTURE_REPEAT, // Still held, every HOLD_REPEAT_TIME after LONG
+    GESTURE_DOUBLE, // Second press within DOUBLE_TAP_TIME
+    GESTURE_CHORD   // Pressed within CHORD_TIME of the other button
+};
+
+// A press that makes a DOUBLE or CHORD is done with: it doesn't CLICK, LONG
+// or REPEAT as well, and neither does the other press of a chord.
+
+struct Gesture
+{
+    GestureType type;
+    ButtonId button;
+    unsigned long time; // millis() of the press edge that started it
+};
+
+#if FEATURE_BUTTONS
 class Buttons
 {
 public:
     Buttons();
     void begin();
 
-    // Main update function, returns true if any button state changed
+    // Main update function, returns true if any gestures are waiting
     bool update();
 
-    // Button state queries
-    bool wasLeftButtonPressed() const { return leftPressed && !leftButton.isLongPress; }
-    bool wasRightButtonPressed() const { return rightPressed && !rightButton.isLongPress; }
-    bool isLeftLongPress() const { return leftButton.isLongPress && leftLongPressTriggered; }
-    bool isRightLongPress() const { return rightButton.isLongPress && rightLongPressTriggered; }
-
-    // Reset states after handling
-    void clearButtonStates();
+    // Pops the oldest recognized gesture, returns false when there are none
+    bool nextGesture(Gesture &gesture);
 
 private:
-    Button leftButton;
-    Button rightButton;
-
-    bool leftPressed;
-    bool rightPressed;
-    bool leftLongPressTriggered;
-    bool rightLongPressTriggered;
+    Button buttons[BUTTON_COUNT];
+    Gesture queue[GESTURE_QUEUE_SIZE];
+    uint8_t queueHead;
+    uint8_t queueCount;
 
-    bool handleButton(Button &button, bool &pressedState, bool &longPressTriggered);
-};
\ No newline at end of file
+    void handleButton(ButtonId id, int reading, unsigned long currentTime);
+    void recognize(uint8_t trigger, ButtonId id, unsigned long currentTime);
+    void push(GestureType type, ButtonId id, unsigned long time);
+};
+#else
+// Builds without footswitches never see a gesture
+class Buttons
+{
+public:
+    void begin() {}
+    bool update() { return false; }
+    bool nextGesture(Gesture &gesture) { return false; }
+};
+#endif
@@ -1,5 +1,38 @@
 #pragma once
 
+// Build components. Each one can be switched off with -D FEATURE_<NAME>=0,
+// its header then swaps the class for a stand-in with the same interface
+// whose calls compile to nothing, so the rest of the code needs no #ifs.
+// The stage build (-D STAGE_BUILD) is headless: no Wi-Fi, web interface or
+// event trace, and no debug output.
+#ifdef STAGE_BUILD
+#ifndef FEATURE_NETWORK
+#define FEATURE_NETWORK 0
+#endif
+#ifndef FEATURE_TRACE
+#define FEATURE_TRACE 0
+#endif
+#endif
+
+#ifndef FEATURE_NETWORK
+#define FEATURE_NETWORK 1 // Wi-Fi, web interface and OTA
+#endif
+#ifndef FEATURE_TRACE
+#define FEATURE_TRACE 1 // Event trace in RAM, served at /api/trace
+#endif
+#ifndef FEATURE_DISPLAY
+#define FEATURE_DISPLAY 1 // HT16K33 alphanumeric display
+#endif
+#ifndef FEATURE_BUTTONS
+#define FEATURE_BUTTONS 1 // Footswitch gestures
+#endif
+#ifndef FEATURE_METRONOME
+#define FEATURE_METRONOME 1 // Beat scheduling and outputs, off keeps only the tempo
+#endif
+#ifndef FEATURE_STORAGE
+#define FEATURE_STORAGE 1 // Patches and settings in flash, off boots the defaults
+#endif
+
 // WiFi configuration - these will be provided by build flags
 #ifndef WIFI_SSID
 #define WIFI_SSID "default_ssid" // Fallback value
@@ -9,7 +42,29 @@
 #define WIFI_PASSWORD "default_password" // Fallback value
 #endif
 
-#define WIFI_TIMEOUT 30000 // 30 seconds timeout
+#define WIFI_TIMEOUT 30000     // 30 seconds timeout for a full scan
+#define WIFI_FAST_TIMEOUT 5000 // Timeout for a cached BSSID/channel attempt
+#define WIFI_BACKOFF_MIN 1000  // First reconnect retry delay
+#define WIFI_BACKOFF_MAX 60000 // Retry delay cap
+
+// Optional static IP, leave undefined to use DHCP
+// #define WIFI_STATIC_IP 192, 168, 1, 50
+// #define WIFI_STATIC_GATEWAY 192, 168, 1, 1
+// #define WIFI_STATIC_SUBNET 255, 255, 255, 0
+
+// OTA update. Uploads need HTTP basic auth with OTA_PASSWORD, from
+// secrets.ini; without one they are refused.
+#define OTA_USERNAME "admin"
+#define OTA_BEAT_GUARD 80 // No flash write starts this close (ms) to a beat
+
+// The core reads a request with blocking reads, a slow client is cut off
+#define HTTP_REQUEST_TIMEOUT 1000 // ms a request may take to arrive
+#define HTTP_BEAT_POLL 1000       // us between beat polls while a request is read
+
+// Event trace
+#define TRACE_BUFFER_SIZE 512 // Events kept, must be a power of two
+#define TRACE_MAGIC 0x4352544D // "MTRC"
+#define TRACE_VERSION 2 // 2: beat lateness in us, at the LED pulse
 
 // Pin Definitions for ESP8266
 #define LEFT_SWITCH_PIN 14  // D5
@@ -19,16 +74,58 @@
 
 // Timing Constants
 #define HOLD_THRESHOLD 1000      // Long press threshold in ms
-#define DEBOUNCE_TIME 50         // Debounce time in ms
+#define HOLD_REPEAT_TIME 400     // Repeat interval while held past the threshold
+#define DEBOUNCE_TIME 50         // Bounce lockout after an accepted edge in ms
+#define DOUBLE_TAP_TIME 300      // Max gap between presses of a double tap
+#define CHORD_TIME 100           // Max gap between the two presses of a chord
+#define GESTURE_QUEUE_SIZE 8
 #define TAP_TIMEOUT 2000         // Tap tempo timeout
+#define BEATS_PER_BAR 4
+#define PATCH_TEMPO_CHANGE TEMPO_NEXT_BEAT // When a new patch's tempo starts
 #define DISPLAY_TOGGLE_TIME 3000 // Display toggle time in ms
 #define LIVE_GIG_TIMEOUT 20000   // 20 seconds timeout
 
+// Beat outputs, offsets are each output's pipeline delay in us
+#define BEAT_PULSE_LENGTH 50000 // Beat LED/cue on time in us
+#define OUTPUT_OFFSET_LED 0
+#define OUTPUT_OFFSET_CLICK 0
+#define OUTPUT_OFFSET_CLOCK 0
+#define OUTPUT_CALIBRATION_RUNS 8
+// #define DISPLAY_BEAT_CUE // Blink the second decimal point on the beat
+
+// Realtime core (IRAM beat timer and edge capture)
+#define EDGE_QUEUE_SIZE 16             // Footswitch edges held for Buttons
+#define PROFILE_THRASH_BASE 0x40200000 // Start of the memory-mapped flash
+#define PROFILE_THRASH_SIZE 65536      // Flash read per pass to evict the cache
+#define PROFILE_REPORT_INTERVAL 10000  // Profile printout period in ms
+
+// Loop stall watch (see stall_watch.h)
+#define STALL_BUDGET_US 10000 // A loop() pass longer than this is a stall
+#define STALL_SAMPLE_US 1000  // Blame sampling period while a stall lasts
+#define STALL_RING_SIZE 16    // Stalls kept in RTC memory across resets
+#define STALL_REPORT_COUNT 5  // Longest stalls sent over serial and the web API
+
+// Binary serial control (see serial_control.h)
+#define SERIAL_SYNC 0xA5
+#define SERIAL_MAX_PAYLOAD 11
+#define SERIAL_QUEUE_SIZE 8 // Decoded commands waiting for loop()
+
+// Web interface changes waiting for loop(), must be a power of two
+#define CONTROL_QUEUE_SIZE 8
+
 // Storage Constants
-#define SETTINGS_ADDR 0
-#define PATCHES_ADDR sizeof(Settings)
+#define STORAGE_SIZE 512
 #define MAX_PATCHES 10
-#define SETTINGS_CHECKSUM 0xABCD
+#define STORE_MAGIC 0x3253544D // "MTS2", layout in storage_schema.h
+#define STORE_VERSION 2
+
+// RTC user memory (4-byte blocks), the first 128 bytes belong to OTA
+#define RTC_STATE_OFFSET 32
+#define RTC_STATE_MAGIC 0x4D455452 // "METR"
+#define RTC_STALL_OFFSET 56        // Stall ring, after the checkpoint
+#define STALL_MAGIC 0x4C545353     // "SSTL"
 
 // I2C Display Address
-#define DISPLAY_ADDR 0x70
\ No newline at end of file
+#define DISPLAY_ADDR 0x70
+#define DISPLAY_DECIMAL_BIT 0x4000
+#define MAX_BRIGHTNESS 15 // HT16K33 dimming steps 0-15
\ No newline at end of file
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Arduino.h>
+#include "config.h"
+#include "types.h"
+#include "spsc_queue.h"
+#include "patch_table.h"
+
+enum ControlType : uint8_t
+{
+    CONTROL_ADD_PATCH,      // patch
+    CONTROL_UPDATE_PATCH,   // value: index, patch
+    CONTROL_DELETE_PATCH,   // value: index
+    CONTROL_SET_BRIGHTNESS  // value: brightness
+};
+
+// A change from the web interface, applied by loop()
+struct ControlCommand
+{
+    ControlType type;
+    uint8_t value;
+    Patch patch;
+};
+
+typedef SpscQueue<ControlCommand, CONTROL_QUEUE_SIZE> ControlQueue;
+
+// Applies a patch command to a table being edited. Indexes are checked
+// again here since earlier commands may have moved things. Returns false if
+// the command no longer applies.
+bool applyPatchCommand(const ControlCommand &command, PatchSnapshot &table);
+
+// Whether after plays differently from before, so its tempo has to be set
+// again. Other edits leave a ramp that is playing alone.
+bool changesTempo(const Patch &before, const Patch &after);
+
+extern ControlQueue controlQueue;
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Standard CRC-32 (IEEE 802.3), pass a previous result as crc to continue
+uint32_t crc32(const void *data, size_t length, uint32_t crc = 0);
+
+// CRC-8, polynomial 0x07, pass a previous result as crc to continue
+uint8_t crc8(const void *data, size_t length, uint8_t crc = 0);
@@ -1,16 +1,21 @@
 #pragma once
 
 #include <Arduino.h>
+#include "config.h"
+#include "types.h"
+#if FEATURE_DISPLAY
 #include <Adafruit_GFX.h>
 #include "Adafruit_LEDBackpack.h"
-#include "types.h"
+#endif
 
+#if FEATURE_DISPLAY
 class Display
 {
 public:
     Display();
     void begin();
     void setBrightness(uint8_t brightness);
+    void setBeatCue(bool on);
     void update(Mode currentMode, int currentPatch, const Patch *patches,
                 int currentTempo, bool showingPatchName, bool wifiConnected,
                 bool liveGigMode);
@@ -18,4 +23,17 @@ public:
 private:
     Adafruit_AlphaNum4 alphaDisplay;
     void writeDigitWithFlags(int position, char character, bool showDecimal);
-};
\ No newline at end of file
+};
+#else
+// Builds without a display keep the calls, they compile to nothing
+class Display
+{
+public:
+    void begin() {}
+    void setBrightness(uint8_t brightness) {}
+    void setBeatCue(bool on) {}
+    void update(Mode currentMode, int currentPatch, const Patch *patches,
+                int currentTempo, bool showingPatchName, bool wifiConnected,
+                bool liveGigMode) {}
+};
+#endif
\ No newline at end of file
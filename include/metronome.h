@@ -1,29 +1,119 @@
 #pragma once
 
 #include <Arduino.h>
+#include "config.h"
+#include "outputs.h"
+#include "tempo_curve.h"
 
+// When a tempo change takes effect
+enum TempoChange : uint8_t
+{
+    TEMPO_NOW,       // Right away, the current beat keeps its phase
+    TEMPO_NEXT_BEAT, // From the next beat on
+    TEMPO_NEXT_BAR   // From the next downbeat on
+};
+
+// Where the beat is, enough to pick it up on the same grid after a reset
+struct BeatState
+{
+    TempoRamp ramp;     // Where a curve has got to
+    uint32_t beatCount; // Beats out since start, for the bar position
+    uint32_t interval;  // us from the last beat to the next
+    uint16_t tempo;
+    uint8_t running;
+    uint8_t reserved;
+};
+
+#if FEATURE_METRONOME
 class Metronome
 {
 public:
     Metronome();
     void begin();
     void update(bool displayActive);
+    void poll() { update(outputActive); }
     void start();
     void stop();
-    void tap();
-    void setTempo(int newTempo);
+    void tap(unsigned long tapTime);
+    // Returns the micros() time the new tempo takes effect from. With a
+    // curve the tempo then follows it beat by beat, starting at newTempo.
+    unsigned long setTempo(int newTempo, TempoChange when = TEMPO_NOW, const TempoCurve *curve = nullptr);
+    // Picks the beat up from a checkpoint, sinceLastBeat us after its last
+    // beat went out
+    void resume(const BeatState &state, unsigned long sinceLastBeat);
+    void getState(BeatState &state) const;
     int getTempo() const { return tempo; }
     bool isRunning() const { return running; }
+    unsigned long getLastBeat() const { return lastBeat; }
+    unsigned long getNextBeat() const { return nextBeat; }
+    uint32_t getBeatCount() const { return beatCount; }
     bool isInTapMode() const { return tapMode; }
     void setLiveGigMode(bool enabled) { liveGigMode = enabled; }
+    bool isLiveGigMode() const { return liveGigMode; }
+    unsigned long getTimeToNextBeat() const;
+    BeatOutputs &getOutputs() { return outputs; }
 
 private:
     bool running;
     bool tapMode;
     bool liveGigMode;
+    bool outputActive;
     int tempo;
-    unsigned long lastBeat;
+    unsigned long lastBeat; // micros()
+    unsigned long nextBeat; // micros(), already handed to the outputs
+    unsigned long interval; // us, the last one handed out, worked out on a tempo change only
+    uint32_t beatCount;     // Beats out since start, the first is a downbeat
     unsigned long lastTapTime;
+    BeatOutputs outputs;
+    TempoRamp ramp;
+
+    // Waiting for its beat, pendingTempo is 0 when there is none
+    int pendingTempo;
+    TempoChange pendingWhen;
+    TempoCurve pendingCurve;
 
+    unsigned long nextInterval();
+    void changeTempo(int newTempo, const TempoCurve &curve);
+    void applyPending();
     void generateBeat(bool displayActive);
-};
\ No newline at end of file
+};
+#else
+// Builds without the metronome keep the tempo and patch handling, but
+// never start and never beat
+class Metronome
+{
+public:
+    void begin() {}
+    void update(bool displayActive) {}
+    void poll() {}
+    void start() {}
+    void stop() {}
+    void tap(unsigned long tapTime) {}
+    unsigned long setTempo(int newTempo, TempoChange when = TEMPO_NOW, const TempoCurve *curve = nullptr)
+    {
+        tempo = constrain(newTempo, 40, 240);
+        return micros();
+    }
+    void resume(const BeatState &state, unsigned long sinceLastBeat) { setTempo(state.tempo); }
+    void getState(BeatState &state) const
+    {
+        memset((void *)&state, 0, sizeof(state));
+        state.tempo = tempo;
+    }
+    int getTempo() const { return tempo; }
+    bool isRunning() const { return false; }
+    unsigned long getLastBeat() const { return 0; }
+    unsigned long getNextBeat() const { return 0; }
+    uint32_t getBeatCount() const { return 0; }
+    bool isInTapMode() const { return false; }
+    void setLiveGigMode(bool enabled) { liveGigMode = enabled; }
+    bool isLiveGigMode() const { return liveGigMode; }
+    unsigned long getTimeToNextBeat() const { return 0; }
+    BeatOutputs &getOutputs() { return outputs; }
+
+private:
+    int tempo = 120;
+    bool liveGigMode = false;
+    BeatOutputs outputs;
+};
+#endif
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <Arduino.h>
+
+enum OutputChannel
+{
+    OUTPUT_LED,
+    OUTPUT_DISPLAY,
+    OUTPUT_CLICK,
+    OUTPUT_CLOCK,
+    OUTPUT_COUNT
+};
+
+// Called with true at the beat and false when the pulse ends
+typedef void (*OutputHandler)(bool active);
+
+// Hands the output's fire time (micros) to a timer that fires and ends the
+// pulse on its own, armed is false to cancel
+typedef void (*OutputScheduler)(bool armed, unsigned long fireTime);
+
+// Beat output stage. Each output has its own pipeline delay, so it is fired
+// early by its offset and they all land on the same musical instant.
+class BeatOutputs
+{
+public:
+    BeatOutputs();
+
+    void attach(OutputChannel channel, OutputHandler handler, unsigned long pulseLength);
+    void attachScheduled(OutputChannel channel, OutputScheduler scheduler);
+    void setOffset(OutputChannel channel, unsigned long offset) { outputs[channel].offset = offset; }
+    unsigned long getOffset(OutputChannel channel) const { return outputs[channel].offset; }
+    unsigned long getMaxOffset() const;
+
+    // Fires every output whose lead time before beatTime (micros) has come,
+    // and ends pulses that are due. Scheduled outputs are armed for beatTime
+    // as soon as it is known, and re-armed if it moves.
+    void update(unsigned long beatTime);
+
+    // Re-arms all outputs once the beat at beatTime has been emitted
+    void beatDone();
+    void allOff();
+
+    // Measures how long the output takes to take effect and uses that as
+    // its offset. Returns the offset in us.
+    unsigned long calibrate(OutputChannel channel);
+
+private:
+    struct Output
+    {
+        OutputHandler handler;
+        OutputScheduler scheduler;
+        unsigned long offset;
+        unsigned long pulseLength;
+        unsigned long pulseStart; // Fire time for scheduled outputs
+        bool fired;
+        bool active;
+    };
+
+    Output outputs[OUTPUT_COUNT];
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "config.h"
+#include "types.h"
+
+struct PatchSnapshot
+{
+    Patch patches[MAX_PATCHES];
+    int count;
+};
+
+// Two copies of the patch table. Edits go into the spare copy, which is then
+// published with a single atomic store, so the reader never sees a table in
+// the middle of an edit. One writer and one reader, which may run in
+// different contexts.
+class PatchTable
+{
+public:
+    PatchTable();
+
+    // Reader side. The snapshot stays valid until the reader's next read(),
+    // which also tells the writer it is done with the older one.
+    const PatchSnapshot &read();
+
+    // Writer side, the latest published table
+    const PatchSnapshot &current() const;
+
+    // Writer side. The spare copy filled from the current table, or nullptr
+    // while the reader may still be using it.
+    PatchSnapshot *beginEdit();
+    void publish();
+
+private:
+    PatchSnapshot buffers[2];
+    std::atomic<uint32_t> generation;       // buffers[generation & 1] is current
+    std::atomic<uint32_t> readerGeneration; // Newest generation the reader moved to
+};
+
+extern PatchTable patchTable;
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Hot paths timed in the profiling build (-D REALTIME_PROFILE)
+enum ProfileSlot : uint8_t
+{
+    PROFILE_BEAT_ISR,
+    PROFILE_EDGE_ISR,
+    PROFILE_METRONOME,
+    PROFILE_BUTTONS,
+    PROFILE_OUTPUTS,
+    PROFILE_SLOT_COUNT
+};
+
+#ifdef REALTIME_PROFILE
+
+struct ProfileStats
+{
+    uint32_t maxCycles;
+    uint32_t totalCycles;
+    uint32_t calls;
+};
+
+extern ProfileStats profileStats[PROFILE_SLOT_COUNT];
+
+// Cycle count of the enclosing scope, worst case kept per slot. Inlined so
+// it runs from wherever the profiled code runs, IRAM included.
+class ProfileScope
+{
+public:
+    inline __attribute__((always_inline)) ProfileScope(ProfileSlot slot)
+        : slot(slot), start(ESP.getCycleCount())
+    {
+    }
+
+    inline __attribute__((always_inline)) ~ProfileScope()
+    {
+        uint32_t cycles = ESP.getCycleCount() - start;
+        ProfileStats &stats = profileStats[slot];
+        if (cycles > stats.maxCycles)
+        {
+            stats.maxCycles = cycles;
+        }
+        stats.totalCycles += cycles;
+        stats.calls++;
+    }
+
+private:
+    ProfileSlot slot;
+    uint32_t start;
+};
+
+#define PROFILE_SCOPE(slot) ProfileScope profileScope(slot)
+
+// Evicts the instruction cache every pass and prints the worst case per
+// slot every PROFILE_REPORT_INTERVAL. Called from loop().
+void profileUpdate();
+
+#else
+#define PROFILE_SCOPE(slot)
+#endif
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <Arduino.h>
+
+// A footswitch edge captured in the GPIO interrupt
+struct EdgeEvent
+{
+    unsigned long time; // millis()
+    uint32_t levels;    // GPIO input register at the edge
+};
+
+// A beat LED pulse as the timer fired it
+struct LedFire
+{
+    unsigned long time;      // micros() the LED went on
+    unsigned long scheduled; // micros() it was armed for
+};
+
+// Realtime core: the beat LED timer and footswitch edge capture. All of it
+// runs from IRAM with its state in DRAM, so it keeps time while the flash
+// cache is stalled by an EEPROM commit, an OTA write or a cache miss in the
+// rest of the firmware.
+class RealtimeCore
+{
+public:
+    void begin();
+
+    // Lights the beat LED at fireTime (micros) for BEAT_PULSE_LENGTH,
+    // replacing any beat not yet fired
+    void scheduleLed(unsigned long fireTime);
+    void cancelLed();
+
+    // Oldest captured edge, returns false when there are none
+    bool popEdge(EdgeEvent &edge);
+
+    // The last pulse fired since the last call, returns false when none
+    bool takeLedFire(LedFire &fire);
+
+    // Worst beat LED lateness vs. its scheduled time, in us
+    unsigned long getMaxLedLateness() const;
+    void resetLedLateness();
+};
+
+extern RealtimeCore realtimeCore;
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <Arduino.h>
+#include "types.h"
+#include "metronome.h"
+
+// Live runtime snapshot kept in RTC user memory. It survives watchdog,
+// exception and soft resets (but not a power cycle), and writing it never
+// touches flash.
+struct RtcCheckpoint
+{
+    uint32_t magic;
+    uint8_t mode;
+    uint8_t patch;
+    uint16_t reserved;
+    uint32_t lastBeatRtc; // RTC timer ticks at the beat state's last beat
+    uint32_t rtcPeriod;   // RTC tick period in us, Q12 fixed point
+    BeatState beat;
+    uint32_t crc;
+};
+
+class RtcState
+{
+public:
+    RtcState();
+
+    // Reads the checkpoint, returns true if the pedal should hot resume
+    bool begin();
+
+    // Call once per loop, only writes RTC memory when something changed.
+    // lastBeat is the micros() time the beat state's interval runs from.
+    void update(Mode mode, int patch, const BeatState &beat, unsigned long lastBeat);
+    void clear();
+
+    Mode getMode() const { return (Mode)checkpoint.mode; }
+    int getPatch() const { return checkpoint.patch; }
+    int getTempo() const { return checkpoint.beat.tempo; }
+    bool wasRunning() const { return checkpoint.beat.running; }
+    const BeatState &getBeatState() const { return checkpoint.beat; }
+
+    // Microseconds elapsed since the last beat before the reset
+    unsigned long getTimeSinceLastBeat() const;
+
+private:
+    RtcCheckpoint checkpoint;
+
+    bool read();
+    void write();
+};
+
+extern RtcState rtcState;
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <Arduino.h>
+#include "config.h"
+#include "types.h"
+#include "metronome.h"
+#include "stall_watch.h"
+
+// Binary control protocol on the USB serial port. Every frame is
+//
+//   0xA5 | type | length | payload (length bytes) | CRC-8 of type..payload
+//
+// with multi-byte fields little-endian. Decoded by tools/serial_control.py,
+// keep both in sync.
+enum SerialFrameType : uint8_t
+{
+    // Host to pedal
+    SERIAL_SET_TEMPO = 0x01,    // u16 BPM, optional u8 TempoChange (default next beat)
+    SERIAL_SELECT_PATCH = 0x02, // u8 index, its tempo starts on the next beat
+    SERIAL_START = 0x03,
+    SERIAL_STOP = 0x04,         // Applied on the next beat
+    SERIAL_QUERY = 0x05,        // Answered with SERIAL_STATE right away
+    SERIAL_STREAM = 0x06,       // u8 0/1, SERIAL_BEAT on every beat
+    SERIAL_GET_STATS = 0x07,    // Answered with SERIAL_STATS right away
+    SERIAL_GET_STALLS = 0x08,   // Answered with SERIAL_STALLS and its SERIAL_STALLs
+
+    // Pedal to host
+    SERIAL_ACK = 0x80,   // u8 type, u32 micros() when it takes effect
+    SERIAL_STATE = 0x81, // u8 mode, u8 patch, u8 running, u16 BPM, u16 ms to next beat
+    SERIAL_BEAT = 0x82,  // u32 micros() of the beat, u16 BPM, u8 patch
+    SERIAL_NAK = 0x83,   // u8 type, u8 SerialError
+    SERIAL_STATS = 0x84,  // u32 us to boot, u16 mean and u16 worst us per loop() pass
+    SERIAL_STALLS = 0x85, // u8 SERIAL_STALLs to follow, u32 stalls since boot, u32 budget us
+    SERIAL_STALL = 0x86   // u8 StallSubsystem, u8 flags, u8 boots ago, u32 us, u32 PC, longest first
+};
+
+enum SerialError : uint8_t
+{
+    SERIAL_ERROR_CHECKSUM = 1,
+    SERIAL_ERROR_UNKNOWN_TYPE,
+    SERIAL_ERROR_BAD_VALUE,
+    SERIAL_ERROR_QUEUE_FULL
+};
+
+struct SerialCommand
+{
+    SerialFrameType type;
+    uint16_t value;
+    TempoChange when;
+};
+
+// Parses byte by byte as data arrives, no allocation. Changes are queued
+// for loop(), which hands them to the metronome's tempo scheduler.
+class SerialControl
+{
+public:
+    SerialControl(Stream &port);
+
+    // Reads whatever has arrived, returns true if commands are waiting
+    bool update();
+
+    // Pops the oldest queued change, returns false when there are none
+    bool nextCommand(SerialCommand &command);
+
+    // True once after a SERIAL_QUERY came in
+    bool takeQuery();
+
+    // True once after a SERIAL_GET_STATS came in
+    bool takeStatsQuery();
+
+    // True once after a SERIAL_GET_STALLS came in
+    bool takeStallsQuery();
+
+    void sendAck(SerialFrameType type, unsigned long time);
+    void sendNak(SerialFrameType type, SerialError error);
+    void sendState(Mode mode, int patch, bool running, int tempo, unsigned long timeToNextBeat);
+    void sendBeat(unsigned long beatTime, int tempo, int patch);
+    void sendStats(unsigned long bootTime, unsigned long meanLoop, unsigned long worstLoop);
+    void sendStalls(uint32_t stallCount, const StallRecord *worst, int count, uint8_t boot);
+
+private:
+    enum ParserState : uint8_t
+    {
+        WAIT_SYNC,
+        READ_TYPE,
+        READ_LENGTH,
+        READ_PAYLOAD,
+        READ_CHECKSUM
+    };
+
+    Stream &port;
+    ParserState state;
+    uint8_t frameType;
+    uint8_t frameLength;
+    uint8_t received;
+    uint8_t crc;
+    uint8_t payload[SERIAL_MAX_PAYLOAD];
+
+    SerialCommand queue[SERIAL_QUEUE_SIZE];
+    uint8_t queueHead;
+    uint8_t queueCount;
+    bool queryPending;
+    bool statsPending;
+    bool stallsPending;
+    bool streaming;
+
+    void parse(uint8_t byte);
+    void dispatch();
+    void send(SerialFrameType type, const uint8_t *data, uint8_t length);
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+// Bounded single-producer single-consumer queue. Each index is written by
+// one side only, so push and pop need no lock and no interrupt masking.
+template <typename T, uint32_t Size>
+class SpscQueue
+{
+    static_assert((Size & (Size - 1)) == 0, "SpscQueue size must be a power of two");
+
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    // Producer side, returns false when full
+    bool push(const T &item)
+    {
+        uint32_t position = tail.load(std::memory_order_relaxed);
+        if (position - head.load(std::memory_order_acquire) == Size)
+        {
+            return false;
+        }
+
+        items[position & (Size - 1)] = item;
+        tail.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, the oldest item or nullptr when empty. Stays valid
+    // until pop().
+    const T *peek() const
+    {
+        uint32_t position = head.load(std::memory_order_relaxed);
+        if (position == tail.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+        return &items[position & (Size - 1)];
+    }
+
+    void pop()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    T items[Size];
+    std::atomic<uint32_t> head; // Next to read, only the consumer writes it
+    std::atomic<uint32_t> tail; // Next to write, only the producer writes it
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <Arduino.h>
+#include "config.h"
+
+// What loop() is busy with, set by STALL_SCOPE and blamed for a stall. Sent
+// by number over serial and decoded by tools/serial_control.py, keep both in
+// sync.
+enum StallSubsystem : uint8_t
+{
+    STALL_LOOP,    // Outside any scope, the core and SDK between passes included
+    STALL_METRONOME,
+    STALL_BUTTONS,
+    STALL_DISPLAY, // I2C writes
+    STALL_STORAGE, // Flash commits
+    STALL_WIFI,    // Connection management
+    STALL_WEB,     // Reading and answering a request
+    STALL_SERIAL,
+    STALL_SUBSYSTEM_COUNT
+};
+
+#define STALL_FLAG_ENDED 0x01 // Clear when the pedal reset before the pass ended
+
+// One loop() pass over budget, three words of RTC user memory
+struct StallRecord
+{
+    uint32_t pc;       // Where the blamed subsystem was last seen
+    uint32_t length;   // us, so far while the stall goes on
+    uint8_t subsystem; // Where most of the time over budget went
+    uint8_t boot;      // Low byte of the boot count it happened in
+    uint8_t flags;
+    uint8_t check;     // Catches garbage and a reset halfway through a write
+};
+
+// Since boot, per subsystem
+struct StallStats
+{
+    uint32_t count;
+    uint32_t worst; // us
+    uint32_t worstPc;
+};
+
+// Software watchdog for loop(). Each pass arms timer0 for STALL_BUDGET_US
+// ahead; a pass that gets there is sampled every STALL_SAMPLE_US from the
+// interrupt, which notes the subsystem and PC and keeps the stall's record up
+// to date in RTC memory. A stall the hardware watchdog ends is still there
+// after the reset, in a ring of the last STALL_RING_SIZE.
+class StallWatch
+{
+public:
+    StallWatch();
+
+    // Reports stalls from before the reset and arms the timer, call at the
+    // end of setup()
+    void begin();
+
+    // Call first thing in loop(), closes the last pass's stall if it had one
+    void newPass();
+
+    // Forgets every stall, the emergency reset
+    void clear();
+
+    const char *getName(uint8_t subsystem) const;
+    const StallStats &getStats(uint8_t subsystem) const { return stats[subsystem]; }
+    uint32_t getStallCount() const { return stallCount; }
+    uint8_t getBoot() const { return boots; }
+
+    // Records in the ring, across resets
+    int getRecordCount() const;
+
+    // The longest stalls in the ring, longest first, returns how many
+    int getWorst(StallRecord *worst, int max) const;
+
+    // Set by StallScope, read by the interrupt
+    volatile uint8_t active;
+
+private:
+    uint32_t budgetCycles;
+    uint32_t sampleCycles;
+    volatile uint32_t passStart;
+    volatile bool stalled;
+    uint16_t head;  // Records ever written, the next slot is head % STALL_RING_SIZE
+    uint16_t boots;
+    uint8_t slot;
+    StallRecord current;
+    uint16_t samples[STALL_SUBSYSTEM_COUNT]; // Of the stall going on
+    StallStats stats[STALL_SUBSYSTEM_COUNT];
+    uint32_t stallCount;
+
+    static void onTimer();
+    void writeHeader();
+    void writeRecord();
+    bool readRecord(int slot, StallRecord &record) const;
+};
+
+extern StallWatch stallWatch;
+
+// Marks the enclosing scope as the given subsystem's, nesting restores the
+// outer one. Two byte stores.
+class StallScope
+{
+public:
+    inline __attribute__((always_inline)) StallScope(StallSubsystem subsystem)
+        : previous(stallWatch.active)
+    {
+        stallWatch.active = subsystem;
+    }
+
+    inline __attribute__((always_inline)) ~StallScope()
+    {
+        stallWatch.active = previous;
+    }
+
+private:
+    uint8_t previous;
+};
+
+#define STALL_SCOPE(subsystem) StallScope stallScope(subsystem)
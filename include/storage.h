@@ -4,7 +4,12 @@
 #include <EEPROM.h>
 #include "types.h"
 #include "config.h"
+#include "storage_schema.h"
 
+// The patches a blank pedal starts with, returns how many
+int defaultPatches(Patch *patches);
+
+#if FEATURE_STORAGE
 class Storage
 {
 public:
@@ -18,14 +23,46 @@ public:
 
     // Patch management
     void loadPatches(Patch *patches, int maxPatches);
-    void savePatches(const Patch *patches, int maxPatches);
-    int getCurrentNumPatches() const;
-    void savePatchCount(int count);
+    void savePatches(const Patch *patches, int count); // Also sets the patch count
+    int getCurrentNumPatches() const { return numPatches; }
+
+    // Saves skipped because the persisted bytes would not have changed
+    unsigned long getElidedWrites() const { return elidedWrites; }
+    unsigned long getCommitCount() const { return commitCount; }
 
 private:
     int numPatches;
+    StoreHeader header; // As in flash once begin() returns
+
+    unsigned long elidedWrites;
+    unsigned long commitCount;
+
+    bool commit();
+    void putHeader();
+    void upgradeLegacy();
+    void recoverHeader();
     bool validatePatch(const Patch &patch);
     void initializeDefaultPatches(Patch *patches);
 };
+#else
+// Builds without flash storage boot the default patches and settings every
+// time, and saves go nowhere
+class Storage
+{
+public:
+    void begin() {}
+    Settings loadSettings() { return getDefaultSettings(); }
+    void saveSettings(const Settings &settings) {}
+    Settings getDefaultSettings() { return {1}; } // Low brightness
+    void loadPatches(Patch *patches, int maxPatches) { numPatches = defaultPatches(patches); }
+    void savePatches(const Patch *patches, int count) { numPatches = count; }
+    int getCurrentNumPatches() const { return numPatches; }
+    unsigned long getElidedWrites() const { return 0; }
+    unsigned long getCommitCount() const { return 0; }
+
+private:
+    int numPatches = 0;
+};
+#endif
 
 extern Storage storage;
\ No newline at end of file
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <Arduino.h>
+#include "config.h"
+
+// On-flash layout, version STORE_VERSION. A StoreHeader at address 0, then
+// `count` records of `recordSize` bytes each. A later version may only append
+// fields to PackedPatch: it raises recordSize, and a reader takes the prefix
+// it knows, so older data loads without a wipe.
+struct __attribute__((packed)) StoreHeader
+{
+    uint32_t magic;      // STORE_MAGIC
+    uint8_t version;
+    uint8_t count;       // Records in use
+    uint16_t recordSize; // Stride of the records, >= sizeof(PackedPatch)
+    uint8_t brightness;
+    uint32_t crc;        // CRC32 of the fields above
+};
+
+// Tempo flags, the low bits hold the CurveType
+#define PATCH_FLAG_CURVE_MASK 0x03
+
+struct __attribute__((packed)) PackedPatch
+{
+    uint32_t crc;     // CRC32 of the rest of the record, recordSize - 4 bytes
+    char name[4];     // Not terminated
+    uint16_t tempo;   // BPM in Q8.8
+    uint8_t flags;
+    uint8_t endTempo; // Curve, BPM
+    uint8_t bars;
+    int8_t step;
+};
+
+#define STORE_HEADER_ADDR 0
+#define STORE_RECORDS_ADDR sizeof(StoreHeader)
+#define PACKED_TEMPO_SHIFT 8
+
+static_assert(sizeof(StoreHeader) + MAX_PATCHES * sizeof(PackedPatch) <= STORAGE_SIZE,
+              "Patch store does not fit the EEPROM sector");
+
+// Layout written by firmware before the header existed, read once to upgrade.
+// Laid out by the compiler with its padding, as that firmware did.
+struct LegacySettings
+{
+    uint8_t brightness;
+    uint32_t checksum;
+};
+
+struct LegacyPatchRecord
+{
+    char name[5];
+    int32_t tempo;
+};
+
+struct LegacyCurve
+{
+    uint8_t type;
+    int8_t step;
+    uint16_t bars;
+    uint16_t endTempo;
+};
+
+struct LegacyCurveTable
+{
+    LegacyCurve curves[MAX_PATCHES];
+    uint32_t crc; // CRC32 of the curves
+};
+
+#define LEGACY_SETTINGS_ADDR 0
+#define LEGACY_PATCHES_ADDR sizeof(LegacySettings)
+#define LEGACY_CRC_ADDR (LEGACY_PATCHES_ADDR + MAX_PATCHES * sizeof(LegacyPatchRecord)) // One CRC32 per patch
+#define LEGACY_CURVE_ADDR (LEGACY_CRC_ADDR + MAX_PATCHES * sizeof(uint32_t))
+#define LEGACY_SETTINGS_CHECKSUM 0xABCD // Settings marker used before CRC32
+#define LEGACY_CRC_UNWRITTEN 0xFFFFFFFF // CRC slot left by firmware older than the CRCs
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Arduino.h>
+#include "types.h"
+
+// False for curves that can't be played from any tempo (bad type, end tempo
+// out of range, no bars or more than fit a byte in flash, a step of 0)
+bool validateCurve(const TempoCurve &curve);
+
+// Plays a TempoCurve one beat at a time in fixed point, then holds the end
+// tempo. The tempo moves by forward differencing and the beat interval
+// follows it by Newton steps on the reciprocal, so a beat costs a few
+// multiplies and no division; only start() and the jump of a STEP curve
+// divide.
+class TempoRamp
+{
+public:
+    TempoRamp();
+
+    // The first interval handed out is at startTempo
+    void start(int startTempo, const TempoCurve &curve);
+    void stop() { active = false; }
+    bool isActive() const { return active; }
+
+    // Interval in us from the beat going out now to the next one. Fractions
+    // of a us carry over so beat times don't drift from the curve.
+    unsigned long nextInterval();
+
+    // Whole BPM of the last interval handed out
+    int getTempo() const { return (playing + (1UL << 23)) >> 24; }
+
+private:
+    bool active;
+    bool rising;
+    uint8_t type;
+    uint32_t tempo;       // Of the next interval, BPM in Q8.24
+    uint32_t playing;     // Of the last interval handed out, Q8.24
+    int32_t delta;        // Added to tempo every beat (LINEAR), Q8.24
+    uint32_t remainder;   // What delta leaves out, in 1/segmentBeats units
+    uint32_t carry;       // Bresenham style, one more unit when it fills
+    int32_t stepSize;     // Added to tempo every segment (STEP), Q8.24
+    uint32_t endTempo;    // Q8.24
+    uint32_t segmentBeats;
+    uint32_t beatsLeft;   // In this segment
+    uint32_t reciprocal;  // 2^37 / BPM, kept in step with tempo
+    uint64_t fraction;    // Sub-us part of the beat times carried over, Q37
+
+    void seedReciprocal();
+    void refineReciprocal();
+};
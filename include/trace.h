@@ -0,0 +1,89 @@
+#pragma once
+
+#include <Arduino.h>
+#include "config.h"
+
+// Event types, a/b meaning per type. Decoded by tools/trace_analyze.py, keep
+// both in sync.
+enum TraceEventType : uint8_t
+{
+    TRACE_BEAT = 1,      // At the LED pulse, b: its lateness in us
+    TRACE_BUTTON_EDGE,   // a: pin, b: level read
+    TRACE_GESTURE,       // a: GestureType, b: pin
+    TRACE_DISPLAY_FLUSH, // b: I2C write duration in us
+    TRACE_FLASH_COMMIT,  // b: commit duration in ms
+    TRACE_HTTP_REQUEST,  // a: HTTP method, b: handling duration in ms
+    TRACE_WIFI_STATE,    // a: new WifiState
+    TRACE_HTTP_DROPPED   // b: ms the request had been arriving for
+};
+
+struct TraceEvent
+{
+    uint32_t timestamp; // micros()
+    uint8_t type;
+    uint8_t a;
+    uint16_t b;
+};
+
+// Header of the /api/trace download
+struct TraceHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t eventSize;
+    uint32_t count;
+    uint32_t now; // micros() when the snapshot was taken
+};
+
+#if FEATURE_TRACE
+// Fixed-size RAM ring of the most recent events, oldest overwritten first
+class TraceRecorder
+{
+public:
+    TraceRecorder() : head(0) {}
+
+    void record(uint8_t type, uint8_t a = 0, uint16_t b = 0)
+    {
+        recordAt(micros(), type, a, b);
+    }
+
+    // For an event that happened before loop() got to it
+    void recordAt(uint32_t timestamp, uint8_t type, uint8_t a = 0, uint16_t b = 0)
+    {
+        TraceEvent &event = events[head & (TRACE_BUFFER_SIZE - 1)];
+        event.timestamp = timestamp;
+        event.type = type;
+        event.a = a;
+        event.b = b;
+        head++;
+    }
+
+    uint32_t getCount() const { return min(head, (uint32_t)TRACE_BUFFER_SIZE); }
+
+    // Oldest event first, index < getCount()
+    const TraceEvent &getEvent(uint32_t index) const
+    {
+        return events[(head - getCount() + index) & (TRACE_BUFFER_SIZE - 1)];
+    }
+
+private:
+    TraceEvent events[TRACE_BUFFER_SIZE];
+    uint32_t head;
+};
+#else
+// Stage builds keep the record() calls, they compile to nothing
+class TraceRecorder
+{
+public:
+    void record(uint8_t type, uint8_t a = 0, uint16_t b = 0) {}
+    void recordAt(uint32_t timestamp, uint8_t type, uint8_t a = 0, uint16_t b = 0) {}
+};
+#endif
+
+// Saturates a duration into an event's 16-bit field
+inline uint16_t traceDuration(unsigned long duration)
+{
+    return duration > 0xFFFF ? 0xFFFF : duration;
+}
+
+extern TraceRecorder trace;
@@ -12,7 +12,23 @@ enum Mode
 struct Settings
 {
     uint8_t brightness;
-    uint32_t checksum;
+};
+
+// Practice ramp starting from the patch tempo. LINEAR sweeps to endTempo
+// over `bars` bars, STEP adds `step` BPM every `bars` bars until endTempo.
+enum CurveType : uint8_t
+{
+    CURVE_NONE,
+    CURVE_LINEAR,
+    CURVE_STEP
+};
+
+struct TempoCurve
+{
+    uint8_t type; // CurveType
+    int8_t step;
+    uint16_t bars;
+    uint16_t endTempo;
 };
 
 // Patch structure
@@ -20,22 +36,27 @@ struct Patch
 {
     char name[5]; // 4 chars + null terminator
     int tempo;
+    TempoCurve curve;
 };
 
 // Button state structure
 struct Button
 {
     int pin;
-    bool lastState;
     bool currentState;
-    unsigned long lastDebounceTime;
+    unsigned long lockoutStart;  // Edges are ignored for DEBOUNCE_TIME after this
     unsigned long pressStartTime;
+    unsigned long lastPressTime; // Previous press, for double taps
+    unsigned long nextHoldTime;  // When the next LONG/REPEAT is due
     bool isLongPress;
+    bool combined;               // This press made a DOUBLE or CHORD, it won't CLICK or hold
 
     Button(int _pin) : pin(_pin),
-                       lastState(HIGH),
                        currentState(HIGH),
-                       lastDebounceTime(0),
+                       lockoutStart(0),
                        pressStartTime(0),
-                       isLongPress(false) {}
+                       lastPressTime(0),
+                       nextHoldTime(0),
+                       isLongPress(false),
+                       combined(false) {}
 };
\ No newline at end of file
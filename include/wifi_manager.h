@@ -5,11 +5,21 @@
 #include "config.h"
 #include "types.h"
 #include "display.h"
+#include "metronome.h"
+#include "patch_table.h"
+#include "control.h"
+
+enum WifiState
+{
+    WIFI_CONNECTING,
+    WIFI_CONNECTED,
+    WIFI_BACKOFF
+};
 
 class WiFiManager
 {
 public:
-    WiFiManager(Patch *patches, Settings &settings, Display &display);
+    WiFiManager(PatchTable &patchTable, Settings &settings, Display &display, Metronome &metronome);
     void begin();
     void update();
     bool isConnected() const { return wifiConnected; }
@@ -18,12 +28,56 @@ public:
 private:
     ESP8266WebServer server;
     bool wifiConnected;
-    bool wifiAttempting;
+    bool serverStarted;
+    WifiState state;
     unsigned long wifiStartAttemptTime;
+    unsigned long nextAttemptTime;
+    unsigned long backoffDelay;
+
+    // Last good association, used to skip the channel scan. The address
+    // still comes from DHCP, a lease kept as a static one would never be
+    // renewed.
+    bool hasCachedAp;
+    bool fastPathAttempt;
+    uint8_t cachedBssid[6];
+    int32_t cachedChannel;
+
+    // Reconnect metrics
+    unsigned long connectionLostTime;
+    unsigned long lastReconnectTime;
+    unsigned long worstReconnectTime;
+    uint16_t reconnectCount;
+    uint16_t attemptCount;
+
+    // OTA upload state
+    bool otaPending;
+    bool otaFailed;
+    size_t otaBytes;
+    unsigned long otaStartTime;
+    unsigned long otaThroughput; // bytes per second
+
+    bool httpRequestSeen; // Set by the server hook, for the event trace
+
+    // A request is being read, from yield() inside the core's reads
+    bool serving;
+    bool readCapped; // Cleared for an authorized firmware upload
+    unsigned long requestStart;
 
-    Patch *patches;
+    PatchTable &patchTable;
     Settings &settings;
     Display &display;
+    Metronome &metronome;
 
     void setupServerRoutes();
+    // Queues a change for loop() and answers 202, or 503 when the queue is full
+    void sendControl(const ControlCommand &command);
+    void setState(WifiState newState);
+    void handleClient();
+    void pollWhileServing();
+    void startAttempt();
+    void scheduleRetry();
+    void onConnected();
+    bool otaAuthorized();
+    void handleOtaUpload();
+    void waitForBeatWindow();
 };
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include "api_json.h"
+#include "tempo_curve.h"
+
+static const char *curveNames[] = {"none", "linear", "step"};
+
+void patchesToJson(const Patch *patches, int count, String &response)
+{
+    StaticJsonDocument<PATCHES_JSON_SIZE> doc;
+    JsonArray array = doc.to<JsonArray>();
+
+    for (int i = 0; i < count; i++)
+    {
+        JsonObject patch = array.createNestedObject();
+        patch["name"] = patches[i].name;
+        patch["tempo"] = patches[i].tempo;
+
+        // Left out for flat patches, which keeps the common case small
+        const TempoCurve &curve = patches[i].curve;
+        if (curve.type != CURVE_NONE)
+        {
+            JsonObject ramp = patch.createNestedObject("curve");
+            ramp["type"] = curveNames[curve.type];
+            ramp["end"] = curve.endTempo;
+            ramp["bars"] = curve.bars;
+            ramp["step"] = curve.step;
+        }
+    }
+
+    serializeJson(doc, response);
+}
+
+bool patchFromJson(JsonVariantConst json, Patch &patch)
+{
+    strlcpy(patch.name, json["name"] | "", sizeof(patch.name));
+    patch.tempo = json["tempo"] | 120;
+    if (patch.tempo < 40 || patch.tempo > 240)
+    {
+        return false;
+    }
+
+    // A missing or unplayable curve leaves the patch flat
+    memset(&patch.curve, 0, sizeof(patch.curve));
+    JsonVariantConst ramp = json["curve"];
+    const char *type = ramp["type"] | "none";
+    for (uint8_t i = 0; i < sizeof(curveNames) / sizeof(curveNames[0]); i++)
+    {
+        if (strcmp(type, curveNames[i]) == 0)
+        {
+            patch.curve.type = i;
+        }
+    }
+    patch.curve.endTempo = ramp["end"] | 0;
+    patch.curve.bars = ramp["bars"] | 0;
+    patch.curve.step = ramp["step"] | 0;
+    if (!validateCurve(patch.curve))
+    {
+        memset(&patch.curve, 0, sizeof(patch.curve));
+    }
+    return true;
+}
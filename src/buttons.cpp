@@ -1,91 +1,190 @@
 #include "buttons.h"
 #include "config.h"
+#include "debug.h"
+#include "trace.h"
+#include "realtime.h"
+#include "profiler.h"
+#include "stall_watch.h"
 
-Buttons::Buttons() : leftButton(LEFT_SWITCH_PIN),
-                     rightButton(RIGHT_SWITCH_PIN),
-                     leftPressed(false),
-                     rightPressed(false),
-                     leftLongPressTriggered(false),
-                     rightLongPressTriggered(false)
+#if FEATURE_BUTTONS
+
+// Raw events the gesture table is matched against
+enum ButtonTrigger : uint8_t
+{
+    TRIGGER_DOWN,
+    TRIGGER_UP,
+    TRIGGER_HELD
+};
+
+struct GestureRule
+{
+    GestureType type;
+    ButtonTrigger trigger;
+};
+
+// Checked in order for every raw event. PRESS comes first so the plain press
+// never waits on the others.
+static const GestureRule gestureRules[] = {
+    {GESTURE_PRESS, TRIGGER_DOWN},
+    {GESTURE_DOUBLE, TRIGGER_DOWN},
+    {GESTURE_CHORD, TRIGGER_DOWN},
+    {GESTURE_CLICK, TRIGGER_UP},
+    {GESTURE_LONG, TRIGGER_HELD},
+    {GESTURE_REPEAT, TRIGGER_HELD},
+};
+
+Buttons::Buttons() : buttons{Button(LEFT_SWITCH_PIN), Button(RIGHT_SWITCH_PIN)},
+                     queueHead(0),
+                     queueCount(0)
 {
 }
 
 void Buttons::begin()
 {
-    pinMode(leftButton.pin, INPUT_PULLUP);
-    pinMode(rightButton.pin, INPUT_PULLUP);
+    for (int i = 0; i < BUTTON_COUNT; i++)
+    {
+        pinMode(buttons[i].pin, INPUT_PULLUP);
+    }
 }
 
 bool Buttons::update()
 {
-    bool stateChanged = false;
+    PROFILE_SCOPE(PROFILE_BUTTONS);
+    STALL_SCOPE(STALL_BUTTONS);
 
-    if (handleButton(leftButton, leftPressed, leftLongPressTriggered))
+    // Edges caught by the interrupt carry the time they actually happened
+    EdgeEvent edge;
+    while (realtimeCore.popEdge(edge))
     {
-        stateChanged = true;
+        for (int i = 0; i < BUTTON_COUNT; i++)
+        {
+            handleButton((ButtonId)i, (edge.levels >> buttons[i].pin) & 1, edge.time);
+        }
     }
-    if (handleButton(rightButton, rightPressed, rightLongPressTriggered))
+
+    // Polling picks up hold timers and any edge the queue had no room for
+    unsigned long currentTime = millis();
+
+    for (int i = 0; i < BUTTON_COUNT; i++)
     {
-        stateChanged = true;
+        handleButton((ButtonId)i, digitalRead(buttons[i].pin), currentTime);
     }
 
-    return stateChanged;
+    return queueCount > 0;
 }
 
-bool Buttons::handleButton(Button &button, bool &pressedState, bool &longPressTriggered)
+bool Buttons::nextGesture(Gesture &gesture)
 {
-    bool stateChanged = false;
-    int reading = digitalRead(button.pin);
-    unsigned long currentTime = millis();
+    if (queueCount == 0)
+    {
+        return false;
+    }
 
-    if (reading != button.lastState)
+    gesture = queue[queueHead];
+    queueHead = (queueHead + 1) % GESTURE_QUEUE_SIZE;
+    queueCount--;
+    return true;
+}
+
+// Acts on the first edge, then ignores contact bounce for DEBOUNCE_TIME. A
+// queued edge can be older than a lockout the poll started, so the compare
+// is signed.
+void Buttons::handleButton(ButtonId id, int reading, unsigned long currentTime)
+{
+    Button &button = buttons[id];
+
+    if (reading != button.currentState && (long)(currentTime - button.lockoutStart) >= DEBOUNCE_TIME)
     {
         DEBUG_PRINTF("Pin %d state changed to: %d\n", button.pin, reading);
-        button.lastDebounceTime = currentTime;
+        trace.record(TRACE_BUTTON_EDGE, button.pin, reading);
+
+        button.currentState = reading;
+        button.lockoutStart = currentTime;
+
+        if (reading == LOW)
+        {
+            button.pressStartTime = currentTime;
+            button.nextHoldTime = currentTime + HOLD_THRESHOLD;
+            button.isLongPress = false;
+            button.combined = false;
+            recognize(TRIGGER_DOWN, id, currentTime);
+            button.lastPressTime = currentTime;
+        }
+        else
+        {
+            recognize(TRIGGER_UP, id, currentTime);
+        }
     }
+    else if (button.currentState == LOW && (long)(currentTime - button.nextHoldTime) >= 0)
+    {
+        recognize(TRIGGER_HELD, id, currentTime);
+        button.isLongPress = true;
+        button.nextHoldTime += HOLD_REPEAT_TIME;
+    }
+}
+
+void Buttons::recognize(uint8_t trigger, ButtonId id, unsigned long currentTime)
+{
+    Button &button = buttons[id];
+    Button &other = buttons[id == BUTTON_LEFT ? BUTTON_RIGHT : BUTTON_LEFT];
 
-    if ((currentTime - button.lastDebounceTime) > DEBOUNCE_TIME)
+    for (const GestureRule &rule : gestureRules)
     {
-        if (reading != button.currentState)
+        if (rule.trigger != trigger)
         {
-            button.currentState = reading;
-
-            if (button.currentState == LOW)
-            { // Button pressed
-                DEBUG_PRINTF("Button on pin %d pressed\n", button.pin);
-                button.pressStartTime = currentTime;
-                button.isLongPress = false;
-                longPressTriggered = false;
-            }
-            else
-            { // Button released
-                if (!button.isLongPress &&
-                    (currentTime - button.pressStartTime < HOLD_THRESHOLD))
-                {
-                    pressedState = true;
-                    stateChanged = true;
-                    DEBUG_PRINTF("Short press detected on pin %d\n", button.pin);
-                }
-            }
+            continue;
         }
-        else if (button.currentState == LOW && !button.isLongPress &&
-                 currentTime - button.pressStartTime >= HOLD_THRESHOLD)
+
+        bool matched = false;
+        switch (rule.type)
         {
-            button.isLongPress = true;
-            longPressTriggered = true;
-            stateChanged = true;
-            DEBUG_PRINTF("Long press detected on pin %d\n", button.pin);
+        case GESTURE_PRESS:
+            matched = true;
+            break;
+        case GESTURE_DOUBLE:
+            matched = button.lastPressTime != 0 &&
+                      currentTime - button.lastPressTime <= DOUBLE_TAP_TIME;
+            button.combined |= matched;
+            break;
+        case GESTURE_CHORD:
+            matched = other.currentState == LOW &&
+                      currentTime - other.pressStartTime <= CHORD_TIME;
+            button.combined |= matched;
+            other.combined |= matched;
+            break;
+        case GESTURE_CLICK:
+            matched = !button.isLongPress && !button.combined;
+            break;
+        case GESTURE_LONG:
+            matched = !button.isLongPress && !button.combined;
+            break;
+        case GESTURE_REPEAT:
+            matched = button.isLongPress && !button.combined;
+            break;
+        default:
+            break;
         }
-    }
 
-    button.lastState = reading;
-    return stateChanged;
+        if (matched)
+        {
+            push(rule.type, id, button.pressStartTime);
+        }
+    }
 }
 
-void Buttons::clearButtonStates()
+void Buttons::push(GestureType type, ButtonId id, unsigned long time)
 {
-    leftPressed = false;
-    rightPressed = false;
-    leftLongPressTriggered = false;
-    rightLongPressTriggered = false;
-}
\ No newline at end of file
+    DEBUG_PRINTF("Gesture %d on pin %d\n", type, buttons[id].pin);
+    trace.record(TRACE_GESTURE, type, buttons[id].pin);
+
+    // When full, the oldest gesture is dropped
+    if (queueCount == GESTURE_QUEUE_SIZE)
+    {
+        queueHead = (queueHead + 1) % GESTURE_QUEUE_SIZE;
+        queueCount--;
+    }
+
+    queue[(queueHead + queueCount) % GESTURE_QUEUE_SIZE] = {type, id, time};
+    queueCount++;
+}
+#endif
@@ -0,0 +1,58 @@
+#include "control.h"
+
+ControlQueue controlQueue;
+
+// Storage packs the tempo in Q8.8, anything past 255 BPM would wrap
+static bool playable(const Patch &patch)
+{
+    return patch.tempo >= 40 && patch.tempo <= 240;
+}
+
+bool applyPatchCommand(const ControlCommand &command, PatchSnapshot &table)
+{
+    switch (command.type)
+    {
+    case CONTROL_ADD_PATCH:
+        if (table.count >= MAX_PATCHES || !playable(command.patch))
+        {
+            return false;
+        }
+        table.patches[table.count++] = command.patch;
+        return true;
+
+    case CONTROL_UPDATE_PATCH:
+        if (command.value >= table.count || !playable(command.patch))
+        {
+            return false;
+        }
+        table.patches[command.value] = command.patch;
+        return true;
+
+    case CONTROL_DELETE_PATCH:
+        // The last patch stays, patch selection needs one
+        if (command.value >= table.count || table.count == 1)
+        {
+            return false;
+        }
+        for (int i = command.value; i < table.count - 1; i++)
+        {
+            table.patches[i] = table.patches[i + 1];
+        }
+        table.count--;
+        memset(&table.patches[table.count], 0, sizeof(table.patches[table.count]));
+        table.patches[table.count].tempo = 120;
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+bool changesTempo(const Patch &before, const Patch &after)
+{
+    return before.tempo != after.tempo ||
+           before.curve.type != after.curve.type ||
+           before.curve.step != after.curve.step ||
+           before.curve.bars != after.curve.bars ||
+           before.curve.endTempo != after.curve.endTempo;
+}
@@ -1,5 +1,9 @@
 #include "display.h"
 #include "config.h"
+#include "trace.h"
+#include "stall_watch.h"
+
+#if FEATURE_DISPLAY
 
 Display::Display() : alphaDisplay()
 {
@@ -15,6 +19,21 @@ void Display::setBrightness(uint8_t brightness)
     alphaDisplay.setBrightness(brightness);
 }
 
+// Beat cue on the second decimal point, which update() never uses
+void Display::setBeatCue(bool on)
+{
+    STALL_SCOPE(STALL_DISPLAY);
+    if (on)
+    {
+        alphaDisplay.displaybuffer[1] |= DISPLAY_DECIMAL_BIT;
+    }
+    else
+    {
+        alphaDisplay.displaybuffer[1] &= ~DISPLAY_DECIMAL_BIT;
+    }
+    alphaDisplay.writeDisplay();
+}
+
 void Display::writeDigitWithFlags(int position, char character, bool showDecimal)
 {
     alphaDisplay.writeDigitAscii(position, character, showDecimal);
@@ -43,7 +62,8 @@ void Display::update(Mode currentMode, int currentPatch, const Patch *patches,
         }
         else
         {
-            String tempoStr = String(patches[currentPatch].tempo);
+            // The playing tempo, which a ramp moves away from the patch's
+            String tempoStr = String(currentTempo);
             while (tempoStr.length() < 4)
                 tempoStr = " " + tempoStr;
             for (int i = 0; i < 4; i++)
@@ -66,5 +86,9 @@ void Display::update(Mode currentMode, int currentPatch, const Patch *patches,
         }
     }
 
+    STALL_SCOPE(STALL_DISPLAY);
+    unsigned long flushStart = micros();
     alphaDisplay.writeDisplay();
-}
\ No newline at end of file
+    trace.record(TRACE_DISPLAY_FLUSH, 0, traceDuration(micros() - flushStart));
+}
+#endif
@@ -3,18 +3,32 @@
 #include <SPI.h>
 #include "config.h"
 #include "types.h"
+#include "debug.h"
 #include "display.h"
 #include "buttons.h"
 #include "storage.h"
+#if FEATURE_NETWORK
 #include "wifi_manager.h"
+#include "control.h"
+#else
+#include <ESP8266WiFi.h>
+#endif
 #include "metronome.h"
+#include "rtc_state.h"
+#include "realtime.h"
+#include "profiler.h"
+#include "stall_watch.h"
+#include "serial_control.h"
+#include "patch_table.h"
 
 Display display;
 Buttons buttons;
 Metronome metronome;
 Settings settings;
-Patch patches[MAX_PATCHES];
-WiFiManager wifiManager(patches, settings, display); // Initialize with references
+#if FEATURE_NETWORK
+WiFiManager wifiManager(patchTable, settings, display, metronome); // Initialize with references
+#endif
+SerialControl serialControl(Serial);
 
 // Global state
 Mode currentMode = PATCH_MODE;
@@ -23,6 +37,25 @@ bool showingPatchName = true;
 unsigned long lastActivityTime = 0;
 bool displayActive = true;
 unsigned long lastDisplayToggle = 0;
+int shownTempo = 0; // Tempo on the display, a ramp moves it on its own
+uint32_t lastSerialBeat = 0;    // Beat count the last SERIAL_BEAT went out for
+bool serialStopPending = false; // Host stop waiting for the next beat
+const PatchSnapshot *patchSnapshot; // This pass's view of the patch table
+
+// Reported over serial so build variants can be compared
+unsigned long bootTime = 0;  // micros() at the end of setup()
+unsigned long loopStart = 0; // micros() when this loop() pass began
+uint64_t loopTotal = 0; // 32 bits of us would wrap after 71 minutes
+unsigned long loopWorst = 0;
+uint32_t loopCount = 0;
+
+#if !FEATURE_NETWORK
+// Keep the radio off from power-up, nothing in this build uses it
+void preinit()
+{
+  ESP8266WiFiClass::preinitWiFiOff();
+}
+#endif
 
 void updateActivity()
 {
@@ -58,6 +91,28 @@ bool isLiveGigMode()
   return currentState;
 }
 
+void updateDisplay()
+{
+#if FEATURE_NETWORK
+  bool wifiConnected = wifiManager.isConnected();
+#else
+  bool wifiConnected = false;
+#endif
+  shownTempo = metronome.getTempo();
+  display.update(currentMode, currentPatch, patchSnapshot->patches,
+                 shownTempo,
+                 showingPatchName,
+                 wifiConnected,
+                 isLiveGigMode());
+}
+
+#ifdef DISPLAY_BEAT_CUE
+void displayBeatCue(bool active)
+{
+  display.setBeatCue(active);
+}
+#endif
+
 void checkDisplayTimeout()
 {
   if (isLiveGigMode() && displayActive)
@@ -79,14 +134,254 @@ void handleDisplayToggle()
     {
       showingPatchName = !showingPatchName;
       lastDisplayToggle = currentTime;
-      display.update(currentMode, currentPatch, patches,
-                     metronome.getTempo(),
-                     showingPatchName,
-                     wifiManager.isConnected(),
-                     isLiveGigMode());
+      updateDisplay();
+    }
+  }
+}
+
+// Returns the micros() time the patch's tempo starts
+unsigned long selectPatch(int patch)
+{
+  currentPatch = patch;
+  showingPatchName = true;
+  lastDisplayToggle = millis();
+  const Patch &selected = patchSnapshot->patches[currentPatch];
+  return metronome.setTempo(selected.tempo, PATCH_TEMPO_CHANGE, &selected.curve);
+}
+
+// A press acts on its leading edge wherever holding that button means
+// nothing, otherwise it waits for the release (CLICK) to rule out a hold
+void handleGesture(const Gesture &gesture)
+{
+  bool liveGig = isLiveGigMode();
+  int numPatches = patchSnapshot->count;
+
+  if (gesture.type == GESTURE_CHORD)
+  {
+    if (!liveGig)
+    {
+      // Both switches together restart the beat from a downbeat
+      metronome.stop();
+      metronome.start();
+    }
+  }
+  else if (gesture.button == BUTTON_LEFT)
+  {
+    if (gesture.type == GESTURE_LONG)
+    {
+      if (!liveGig)
+      { // Only allow mode change if not in live gig mode
+        currentMode = (currentMode == PATCH_MODE) ? FREE_MODE : PATCH_MODE;
+        showingPatchName = true;
+        lastDisplayToggle = millis();
+
+        if (currentMode == FREE_MODE)
+        {
+          metronome.start();
+        }
+        else
+        {
+          metronome.stop();
+        }
+      }
+    }
+    else if (currentMode == PATCH_MODE &&
+             gesture.type == (liveGig ? GESTURE_PRESS : GESTURE_CLICK))
+    {
+      selectPatch((currentPatch - 1 + numPatches) % numPatches);
+    }
+    else if (currentMode == PATCH_MODE && !liveGig && gesture.type == GESTURE_DOUBLE)
+    {
+      // The first click went back one, a double goes to the top of the set
+      selectPatch(0);
+    }
+  }
+  else if (currentMode == FREE_MODE)
+  {
+    if (gesture.type == GESTURE_PRESS)
+    {
+      metronome.tap(gesture.time);
+    }
+  }
+  else if (gesture.type == GESTURE_LONG || gesture.type == GESTURE_REPEAT)
+  {
+    if (liveGig)
+    {
+      updateActivity(); // Reset timeout
+      DEBUG_PRINTLN("Live Gig timeout reset");
+    }
+    else
+    {
+      // Keep holding to scroll through the patches
+      selectPatch((currentPatch + 1) % numPatches);
+    }
+  }
+  else if (gesture.type == GESTURE_CLICK || gesture.type == GESTURE_DOUBLE)
+  {
+    // A quick second press counts as a second click, at the press
+    if (liveGig)
+    {
+      selectPatch((currentPatch + 1) % numPatches);
+    }
+    else if (metronome.isRunning())
+    {
+      metronome.stop();
+    }
+    else
+    {
+      metronome.start();
+    }
+  }
+}
+
+// Returns false if the command could not be applied, otherwise sets the
+// micros() time it takes effect
+bool handleSerialCommand(const SerialCommand &command, unsigned long &effectTime)
+{
+  effectTime = micros();
+  switch (command.type)
+  {
+  case SERIAL_SET_TEMPO:
+    effectTime = metronome.setTempo(command.value, command.when);
+    break;
+  case SERIAL_SELECT_PATCH:
+    if (command.value >= patchSnapshot->count)
+    {
+      return false;
+    }
+    effectTime = selectPatch(command.value);
+    break;
+  case SERIAL_START:
+    serialStopPending = false;
+    metronome.start();
+    break;
+  case SERIAL_STOP:
+    if (metronome.isRunning())
+    {
+      serialStopPending = true;
+      effectTime = metronome.getNextBeat();
+    }
+    break;
+  default:
+    return false;
+  }
+  return true;
+}
+
+// Tempo changes go to the metronome's scheduler as they arrive and are acked
+// with the time they take effect. A stop waits for the next beat.
+void handleSerial()
+{
+  serialControl.update();
+
+  if (serialControl.takeQuery())
+  {
+    serialControl.sendState(currentMode, currentPatch, metronome.isRunning(),
+                            metronome.getTempo(), metronome.getTimeToNextBeat());
+  }
+
+  if (serialControl.takeStatsQuery())
+  {
+    serialControl.sendStats(bootTime, loopCount ? loopTotal / loopCount : 0, loopWorst);
+    loopTotal = loopWorst = 0;
+    loopCount = 0;
+  }
+
+  if (serialControl.takeStallsQuery())
+  {
+    StallRecord worst[STALL_REPORT_COUNT];
+    int count = stallWatch.getWorst(worst, STALL_REPORT_COUNT);
+    serialControl.sendStalls(stallWatch.getStallCount(), worst, count, stallWatch.getBoot());
+  }
+
+  // Counted rather than timed, a tempo change can move getLastBeat()
+  uint32_t beatCount = metronome.getBeatCount();
+  bool newBeat = beatCount != lastSerialBeat && beatCount != 0;
+  lastSerialBeat = beatCount;
+  if (newBeat && metronome.isRunning())
+  {
+    serialControl.sendBeat(metronome.getLastBeat(), metronome.getTempo(), currentPatch);
+  }
+
+  bool changed = false;
+  if (serialStopPending && (newBeat || !metronome.isRunning()))
+  {
+    metronome.stop();
+    serialStopPending = false;
+    changed = true;
+  }
+
+  SerialCommand command;
+  while (serialControl.nextCommand(command))
+  {
+    unsigned long effectTime;
+    if (handleSerialCommand(command, effectTime))
+    {
+      serialControl.sendAck(command.type, effectTime);
+      changed = true;
+    }
+    else
+    {
+      serialControl.sendNak(command.type, SERIAL_ERROR_BAD_VALUE);
+    }
+  }
+
+  if (changed)
+  {
+    updateDisplay();
+  }
+}
+
+#if FEATURE_NETWORK
+// Web interface changes queued by the request handlers. Patch edits go into
+// the spare table, which is swapped in once they have all been applied.
+void handleControl()
+{
+  PatchSnapshot *edit = nullptr;
+  const ControlCommand *command;
+
+  while ((command = controlQueue.peek()))
+  {
+    if (command->type == CONTROL_SET_BRIGHTNESS)
+    {
+      settings.brightness = command->value;
+      display.setBrightness(settings.brightness);
+      storage.saveSettings(settings);
+    }
+    else
+    {
+      if (!edit && !(edit = patchTable.beginEdit()))
+      {
+        break; // Spare table still being read, try again next pass
+      }
+      if (!applyPatchCommand(*command, *edit))
+      {
+        DEBUG_PRINTF("Control command %d no longer applies\n", command->type);
+      }
     }
+    controlQueue.pop();
+  }
+
+  if (!edit)
+  {
+    return;
   }
+
+  const Patch playing = patchSnapshot->patches[currentPatch];
+  patchTable.publish();
+  patchSnapshot = &patchTable.read();
+  storage.savePatches(patchSnapshot->patches, patchSnapshot->count);
+
+  // The current patch may have been edited, moved or deleted
+  currentPatch = min(currentPatch, patchSnapshot->count - 1);
+  const Patch &selected = patchSnapshot->patches[currentPatch];
+  if (currentMode == PATCH_MODE && changesTempo(playing, selected))
+  {
+    metronome.setTempo(selected.tempo, TEMPO_NOW, &selected.curve);
+  }
+  updateDisplay();
 }
+#endif
 
 void setup()
 {
@@ -97,60 +392,118 @@ void setup()
   pinMode(LIVE_GIG_PIN, INPUT_PULLUP);
   pinMode(LEFT_SWITCH_PIN, INPUT_PULLUP);
   pinMode(RIGHT_SWITCH_PIN, INPUT_PULLUP);
+  realtimeCore.begin();
 
-  // If both buttons are held during power-up, reset everything
+  // If both buttons are held during power-up, reset everything. Checked
+  // first, a warm reset with a valid checkpoint must not get in the way.
   if (digitalRead(LEFT_SWITCH_PIN) == LOW && digitalRead(RIGHT_SWITCH_PIN) == LOW)
   {
     DEBUG_PRINTLN("Emergency reset triggered!");
-    EEPROM.begin(512);
-    for (int i = 0; i < 512; i++)
+    EEPROM.begin(STORAGE_SIZE);
+    for (int i = 0; i < STORAGE_SIZE; i++)
     {
       EEPROM.write(i, 0xFF);
     }
     EEPROM.commit();
     DEBUG_PRINTLN("EEPROM cleared");
+    rtcState.clear();
+    stallWatch.clear();
     delay(1000);
     ESP.restart();
   }
 
+  // After a watchdog/exception reset, get the beat going again before anything
+  // else so the band doesn't notice
+  bool hotResume = rtcState.begin();
+  if (hotResume)
+  {
+    DEBUG_PRINTLN("Hot resume from RTC checkpoint");
+    metronome.begin();
+    metronome.resume(rtcState.getBeatState(), rtcState.getTimeSinceLastBeat());
+    // Arms the LED for the next beat, the timer fires it while setup() goes on
+    metronome.update(true);
+    currentMode = rtcState.getMode();
+    currentPatch = rtcState.getPatch();
+  }
+
   Wire.begin();
 
+#if FEATURE_NETWORK
   // Initialize WiFi first
   wifiManager.begin();
+#endif
 
   // Then other peripherals
   pinMode(LIVE_GIG_PIN, INPUT_PULLUP);
   display.begin();
   buttons.begin();
   storage.begin();
-  metronome.begin();
+  if (!hotResume)
+  {
+    metronome.begin();
+  }
 
   // Add watchdog
   ESP.wdtEnable(WDTO_8S);
 
   settings = storage.loadSettings();
-  storage.loadPatches(patches, MAX_PATCHES);
+
+  PatchSnapshot *initial = patchTable.beginEdit();
+  storage.loadPatches(initial->patches, MAX_PATCHES);
+  initial->count = storage.getCurrentNumPatches();
+  patchTable.publish();
+  patchSnapshot = &patchTable.read();
 
   display.setBrightness(settings.brightness);
+
+#ifdef DISPLAY_BEAT_CUE
+  // The cue goes out over I2C, so it has to be sent ahead of the beat
+  metronome.getOutputs().attach(OUTPUT_DISPLAY, displayBeatCue, BEAT_PULSE_LENGTH);
+  metronome.getOutputs().calibrate(OUTPUT_DISPLAY);
+#endif
   metronome.setLiveGigMode(isLiveGigMode());
-  metronome.setTempo(patches[currentPatch].tempo);
+
+  if (hotResume)
+  {
+    if (currentPatch >= patchSnapshot->count)
+    {
+      currentPatch = 0;
+    }
+  }
+  else
+  {
+    const Patch &selected = patchSnapshot->patches[currentPatch];
+    metronome.setTempo(selected.tempo, TEMPO_NOW, &selected.curve);
+  }
 
   updateActivity();
   lastDisplayToggle = millis();
 
-  display.update(currentMode, currentPatch, patches,
-                 metronome.getTempo(),
-                 showingPatchName,
-                 wifiManager.isConnected(),
-                 isLiveGigMode());
+  updateDisplay();
+  stallWatch.begin();
+  bootTime = loopStart = micros();
 }
 
 void loop()
 {
   // Reset watchdog timer
   ESP.wdtFeed();
+  stallWatch.newPass();
+
+  // Time between passes, so whatever the core does in between counts too
+  unsigned long now = micros();
+  unsigned long loopTime = now - loopStart;
+  loopStart = now;
+  loopTotal += loopTime;
+  loopWorst = max(loopWorst, loopTime);
+  loopCount++;
 
+  patchSnapshot = &patchTable.read();
+
+#if FEATURE_NETWORK
   wifiManager.update();
+  handleControl();
+#endif
 
   // Update live gig mode from switch
   metronome.setLiveGigMode(isLiveGigMode());
@@ -159,88 +512,29 @@ void loop()
   {
     updateActivity(); // Reset activity timer
 
-    if (buttons.isLeftLongPress())
-    {
-      if (!isLiveGigMode())
-      { // Only allow mode change if not in live gig mode
-        currentMode = (currentMode == PATCH_MODE) ? FREE_MODE : PATCH_MODE;
-        showingPatchName = true;
-        lastDisplayToggle = millis();
-
-        if (currentMode == FREE_MODE)
-        {
-          metronome.start();
-        }
-        else
-        {
-          metronome.stop();
-        }
-      }
-    }
-    else if (buttons.isRightLongPress() && currentMode == PATCH_MODE)
-    {
-      if (isLiveGigMode())
-      {
-        updateActivity(); // Reset timeout
-        DEBUG_PRINTLN("Live Gig timeout reset");
-      }
-      else
-      {
-        currentPatch = (currentPatch + 1) % storage.getCurrentNumPatches();
-        showingPatchName = true;
-        lastDisplayToggle = millis();
-        metronome.setTempo(patches[currentPatch].tempo);
-      }
-    }
-    else if (buttons.wasLeftButtonPressed())
-    {
-      if (currentMode == PATCH_MODE)
-      {
-        currentPatch = (currentPatch - 1 + storage.getCurrentNumPatches()) % storage.getCurrentNumPatches();
-        showingPatchName = true;
-        lastDisplayToggle = millis();
-        metronome.setTempo(patches[currentPatch].tempo);
-      }
-    }
-    else if (buttons.wasRightButtonPressed())
+    Gesture gesture;
+    while (buttons.nextGesture(gesture))
     {
-      if (currentMode == PATCH_MODE)
-      {
-        if (isLiveGigMode())
-        {
-          currentPatch = (currentPatch + 1) % storage.getCurrentNumPatches();
-          showingPatchName = true;
-          lastDisplayToggle = millis();
-          metronome.setTempo(patches[currentPatch].tempo);
-        }
-        else
-        {
-          if (metronome.isRunning())
-          {
-            metronome.stop();
-          }
-          else
-          {
-            metronome.start();
-          }
-        }
-      }
-      else
-      {
-        metronome.tap();
-      }
+      handleGesture(gesture);
     }
 
-    display.update(currentMode, currentPatch, patches,
-                   metronome.getTempo(),
-                   showingPatchName,
-                   wifiManager.isConnected(),
-                   isLiveGigMode());
-
-    buttons.clearButtonStates();
+    updateDisplay();
   }
 
   handleDisplayToggle();
   checkDisplayTimeout();
   metronome.update(displayActive);
+  if (metronome.getTempo() != shownTempo)
+  {
+    updateDisplay();
+  }
+  handleSerial();
+
+  BeatState beat;
+  metronome.getState(beat);
+  rtcState.update(currentMode, currentPatch, beat, metronome.getLastBeat());
+
+#ifdef REALTIME_PROFILE
+  profileUpdate();
+#endif
 }
\ No newline at end of file
@@ -1,76 +1,256 @@
 #include "metronome.h"
 #include "config.h"
+#include "debug.h"
+#include "trace.h"
+#include "realtime.h"
+#include "profiler.h"
+#include "stall_watch.h"
+
+#if FEATURE_METRONOME
 
 Metronome::Metronome() : running(false),
                          tapMode(false),
                          liveGigMode(false),
+                         outputActive(true),
                          tempo(120),
                          lastBeat(0),
-                         lastTapTime(0)
+                         nextBeat(0),
+                         interval(60000000UL / 120),
+                         beatCount(0),
+                         lastTapTime(0),
+                         pendingTempo(0),
+                         pendingWhen(TEMPO_NOW),
+                         pendingCurve{}
+{
+}
+
+// The LED is driven from the realtime core's timer, so it lands on time even
+// while loop() is stuck in a flash write
+static void scheduleBeatLed(bool armed, unsigned long fireTime)
 {
+    if (armed)
+    {
+        realtimeCore.scheduleLed(fireTime);
+    }
+    else
+    {
+        realtimeCore.cancelLed();
+    }
 }
 
 void Metronome::begin()
 {
     pinMode(LED_PIN, OUTPUT);
     digitalWrite(LED_PIN, LOW);
+
+    outputs.attachScheduled(OUTPUT_LED, scheduleBeatLed);
+    outputs.setOffset(OUTPUT_LED, OUTPUT_OFFSET_LED);
+    outputs.setOffset(OUTPUT_CLICK, OUTPUT_OFFSET_CLICK);
+    outputs.setOffset(OUTPUT_CLOCK, OUTPUT_OFFSET_CLOCK);
 }
 
+// The first beat is a downbeat and goes out as soon as the slowest output
+// can make it
 void Metronome::start()
 {
+    if (!running)
+    {
+        nextBeat = micros() + outputs.getMaxOffset();
+        beatCount = 0;
+    }
     running = true;
     tapMode = false;
 }
 
+// A change still waiting for its beat is applied rather than lost. A ramp
+// carries on from where it got to on the next start.
 void Metronome::stop()
 {
+    if (pendingTempo)
+    {
+        changeTempo(pendingTempo, pendingCurve);
+        pendingTempo = 0;
+    }
     running = false;
     tapMode = false;
-    digitalWrite(LED_PIN, LOW);
+    outputs.allOff();
 }
 
-void Metronome::setTempo(int newTempo)
+unsigned long Metronome::setTempo(int newTempo, TempoChange when, const TempoCurve *curve)
 {
-    tempo = constrain(newTempo, 40, 240);
+    static const TempoCurve flat = {};
+    newTempo = constrain(newTempo, 40, 240);
+    unsigned long now = micros();
+    if (!curve)
+    {
+        curve = &flat;
+    }
+
+    if (!running || when == TEMPO_NOW)
+    {
+        pendingTempo = 0;
+        unsigned long oldInterval = interval;
+        bool stretch = running && newTempo != tempo;
+        changeTempo(newTempo, *curve);
+        if (stretch)
+        {
+            // Stretch what is left of this beat so it keeps its phase
+            long remaining = nextBeat - now;
+            if (remaining > 0)
+            {
+                nextBeat = now + (uint64_t)remaining * interval / oldInterval;
+            }
+            lastBeat = nextBeat - interval;
+        }
+        return now;
+    }
+
+    pendingTempo = newTempo;
+    pendingWhen = when;
+    pendingCurve = *curve;
+
+    if (when == TEMPO_NEXT_BEAT)
+    {
+        return nextBeat;
+    }
+
+    // The beat at nextBeat is number beatCount, count on to the next downbeat
+    uint32_t beatsToBar = (BEATS_PER_BAR - beatCount % BEATS_PER_BAR) % BEATS_PER_BAR;
+    return nextBeat + beatsToBar * interval;
 }
 
-void Metronome::tap()
+// Called as a beat goes out, so the change starts with the interval after it
+void Metronome::applyPending()
 {
-    unsigned long currentTime = millis();
+    if (!pendingTempo)
+    {
+        return;
+    }
+
+    // The beat that just went out was beatCount - 1
+    if (pendingWhen == TEMPO_NEXT_BAR && (beatCount - 1) % BEATS_PER_BAR != 0)
+    {
+        return;
+    }
+
+    changeTempo(pendingTempo, pendingCurve);
+    pendingTempo = 0;
+}
+
+// The ramp, if any, hands out its first interval at the next beat. The only
+// division on the beat path is here, a flat tempo reuses its interval.
+void Metronome::changeTempo(int newTempo, const TempoCurve &curve)
+{
+    tempo = newTempo;
+    interval = 60000000UL / tempo;
+    ramp.start(newTempo, curve);
+}
+
+// From the beat that just went out to the next one
+unsigned long Metronome::nextInterval()
+{
+    if (ramp.isActive())
+    {
+        interval = ramp.nextInterval();
+        tempo = ramp.getTempo();
+    }
+    return interval;
+}
+
+// Continue a beat that was interrupted by a reset on its old grid. Beats
+// that fell in the reset are skipped, and a curve moves on past them.
+void Metronome::resume(const BeatState &state, unsigned long sinceLastBeat)
+{
+    tempo = constrain(state.tempo, 40, 240);
+    ramp = state.ramp;
+    beatCount = state.beatCount;
+    running = state.running;
+    tapMode = false;
+    pendingTempo = 0;
+
+    interval = state.interval ? state.interval : 60000000UL / tempo;
+    lastBeat = micros() - sinceLastBeat;
+    while (running && sinceLastBeat >= interval)
+    {
+        sinceLastBeat -= interval;
+        lastBeat += interval;
+        beatCount++;
+        interval = nextInterval();
+    }
+    nextBeat = lastBeat + interval;
+}
+
+// Padding included, so a checkpoint can tell whether anything moved
+void Metronome::getState(BeatState &state) const
+{
+    memset((void *)&state, 0, sizeof(state));
+    memcpy((void *)&state.ramp, (const void *)&ramp, sizeof(ramp));
+    state.beatCount = beatCount;
+    state.interval = interval;
+    state.tempo = tempo;
+    state.running = running;
+}
 
+// tapTime is when the footswitch went down, not when the tap got here
+void Metronome::tap(unsigned long tapTime)
+{
     if (!tapMode)
     {
         tapMode = true;
-        lastTapTime = currentTime;
+        lastTapTime = tapTime;
         return;
     }
 
-    unsigned long tapInterval = currentTime - lastTapTime;
+    unsigned long tapInterval = tapTime - lastTapTime;
     if (tapInterval < TAP_TIMEOUT)
     {
         int newTempo = 60000 / tapInterval;
         if (newTempo >= 40 && newTempo <= 240)
         { // Validate tempo range
             tempo = newTempo;
+            interval = 60000000UL / tempo;
+            ramp.stop();
+            pendingTempo = 0; // A change still waiting would undo the tap
             DEBUG_PRINTF("Tap tempo: %d BPM\n", tempo); // Debug output
         }
     }
-    lastTapTime = currentTime;
+    lastTapTime = tapTime;
+}
+
+unsigned long Metronome::getTimeToNextBeat() const
+{
+    long remaining = nextBeat - micros();
+    return remaining > 0 ? remaining / 1000 : 0;
 }
 
 void Metronome::update(bool displayActive)
 {
+    PROFILE_SCOPE(PROFILE_METRONOME);
+    STALL_SCOPE(STALL_METRONOME);
     unsigned long currentTime = millis();
+    outputActive = displayActive;
+
+    // The beat is traced when the LED timer fired it, not when loop() got here
+    LedFire fire;
+    if (realtimeCore.takeLedFire(fire))
+    {
+        trace.recordAt(fire.time, TRACE_BEAT, 0, traceDuration(fire.time - fire.scheduled));
+    }
 
     if (tapMode && (currentTime - lastTapTime > TAP_TIMEOUT))
     {
         tapMode = false;
+        if (!running)
+        {
+            nextBeat = micros() + outputs.getMaxOffset();
+            beatCount = 0;
+        }
         running = true;
     }
 
     if (!running || (liveGigMode && !displayActive))
     {
-        digitalWrite(LED_PIN, LOW);
+        outputs.allOff();
         return;
     }
 
@@ -81,18 +261,28 @@ void Metronome::generateBeat(bool displayActive)
 {
     if (!displayActive && liveGigMode)
     {
-        digitalWrite(LED_PIN, LOW);
+        outputs.allOff();
         return;
     }
 
-    unsigned long currentTime = millis();
-    unsigned long interval = 60000 / tempo;
+    unsigned long beatTime = nextBeat;
 
-    if (currentTime - lastBeat >= interval)
+    // Outputs with a pipeline delay go out ahead of the beat
+    outputs.update(beatTime);
+
+    unsigned long currentTime = micros();
+    if ((long)(currentTime - beatTime) >= 0)
     {
-        digitalWrite(LED_PIN, HIGH);
-        delayMicroseconds(50000);
-        digitalWrite(LED_PIN, LOW);
-        lastBeat = currentTime;
+        // Anything held up behind a slow output still belongs to this beat
+        outputs.update(beatTime);
+        // Stay on the beat grid so a stalled loop doesn't push every later
+        // beat back, unless a whole beat was missed. interval is still the one
+        // this beat was scheduled with.
+        lastBeat = currentTime - beatTime < interval ? beatTime : currentTime;
+        beatCount++;
+        applyPending();
+        nextBeat = lastBeat + nextInterval();
+        outputs.beatDone();
     }
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,132 @@
+#include "outputs.h"
+#include "config.h"
+#include "debug.h"
+#include "profiler.h"
+
+BeatOutputs::BeatOutputs()
+{
+    memset(outputs, 0, sizeof(outputs));
+}
+
+void BeatOutputs::attach(OutputChannel channel, OutputHandler handler, unsigned long pulseLength)
+{
+    outputs[channel].handler = handler;
+    outputs[channel].scheduler = nullptr;
+    outputs[channel].pulseLength = pulseLength;
+    outputs[channel].fired = false;
+    outputs[channel].active = false;
+}
+
+void BeatOutputs::attachScheduled(OutputChannel channel, OutputScheduler scheduler)
+{
+    outputs[channel].handler = nullptr;
+    outputs[channel].scheduler = scheduler;
+    outputs[channel].fired = false;
+    outputs[channel].active = false;
+}
+
+void BeatOutputs::update(unsigned long beatTime)
+{
+    PROFILE_SCOPE(PROFILE_OUTPUTS);
+    unsigned long now = micros();
+
+    for (int i = 0; i < OUTPUT_COUNT; i++)
+    {
+        Output &output = outputs[i];
+        if (output.scheduler)
+        {
+            // Once the armed time has passed the timer owns that beat, so a
+            // tempo change can't make it fire twice
+            unsigned long fireTime = beatTime - output.offset;
+            if (!output.fired ||
+                (fireTime != output.pulseStart && (long)(output.pulseStart - now) > 0))
+            {
+                output.scheduler(true, fireTime);
+                output.pulseStart = fireTime;
+                output.fired = true;
+                output.active = true;
+            }
+            continue;
+        }
+
+        if (!output.handler)
+        {
+            continue;
+        }
+
+        if (output.active && now - output.pulseStart >= output.pulseLength)
+        {
+            output.handler(false);
+            output.active = false;
+        }
+
+        if (!output.fired && (long)(now + output.offset - beatTime) >= 0)
+        {
+            output.handler(true);
+            output.pulseStart = now;
+            output.fired = true;
+            output.active = true;
+        }
+    }
+}
+
+unsigned long BeatOutputs::getMaxOffset() const
+{
+    unsigned long offset = 0;
+    for (int i = 0; i < OUTPUT_COUNT; i++)
+    {
+        offset = max(offset, outputs[i].offset);
+    }
+    return offset;
+}
+
+void BeatOutputs::beatDone()
+{
+    for (int i = 0; i < OUTPUT_COUNT; i++)
+    {
+        outputs[i].fired = false;
+    }
+}
+
+void BeatOutputs::allOff()
+{
+    for (int i = 0; i < OUTPUT_COUNT; i++)
+    {
+        if (outputs[i].active)
+        {
+            if (outputs[i].scheduler)
+            {
+                outputs[i].scheduler(false, 0);
+            }
+            else
+            {
+                outputs[i].handler(false);
+            }
+            outputs[i].active = false;
+        }
+        outputs[i].fired = false;
+    }
+}
+
+unsigned long BeatOutputs::calibrate(OutputChannel channel)
+{
+    Output &output = outputs[channel];
+    if (!output.handler)
+    {
+        return output.offset;
+    }
+
+    // Shortest of a few runs, longer ones were interrupted by something else
+    unsigned long best = ~0UL;
+    for (int run = 0; run < OUTPUT_CALIBRATION_RUNS; run++)
+    {
+        unsigned long start = micros();
+        output.handler(true);
+        best = min(best, micros() - start);
+        output.handler(false);
+    }
+
+    output.offset = best;
+    DEBUG_PRINTF("Output %d latency: %lu us\n", channel, best);
+    return best;
+}
@@ -0,0 +1,41 @@
+#include "patch_table.h"
+
+PatchTable patchTable;
+
+PatchTable::PatchTable() : generation(0),
+                           readerGeneration(0)
+{
+    memset(buffers, 0, sizeof(buffers));
+}
+
+const PatchSnapshot &PatchTable::read()
+{
+    uint32_t current = generation.load(std::memory_order_acquire);
+    readerGeneration.store(current, std::memory_order_release);
+    return buffers[current & 1];
+}
+
+const PatchSnapshot &PatchTable::current() const
+{
+    return buffers[generation.load(std::memory_order_relaxed) & 1];
+}
+
+PatchSnapshot *PatchTable::beginEdit()
+{
+    uint32_t current = generation.load(std::memory_order_relaxed);
+
+    // The spare copy was current one generation ago
+    if ((int32_t)(readerGeneration.load(std::memory_order_acquire) - current) < 0)
+    {
+        return nullptr;
+    }
+
+    PatchSnapshot &spare = buffers[(current + 1) & 1];
+    spare = buffers[current & 1];
+    return &spare;
+}
+
+void PatchTable::publish()
+{
+    generation.store(generation.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
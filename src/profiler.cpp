@@ -0,0 +1,51 @@
+#include "profiler.h"
+
+#ifdef REALTIME_PROFILE
+
+#include "config.h"
+#include "realtime.h"
+
+ProfileStats profileStats[PROFILE_SLOT_COUNT];
+
+static const char *const slotNames[PROFILE_SLOT_COUNT] = {
+    "beat isr", "edge isr", "metronome", "buttons", "outputs"};
+
+// Reads one word per cache line across PROFILE_THRASH_SIZE of mapped flash,
+// so whatever the hot paths left in the instruction cache is gone
+static void thrashCache()
+{
+    const volatile uint32_t *flash = (const volatile uint32_t *)PROFILE_THRASH_BASE;
+    uint32_t sum = 0;
+    for (uint32_t offset = 0; offset < PROFILE_THRASH_SIZE; offset += 32)
+    {
+        sum += flash[offset / 4];
+    }
+    (void)sum;
+}
+
+void profileUpdate()
+{
+    static unsigned long lastReport = 0;
+
+    thrashCache();
+
+    if (millis() - lastReport < PROFILE_REPORT_INTERVAL)
+    {
+        return;
+    }
+    lastReport = millis();
+
+    uint32_t cyclesPerUs = ESP.getCpuFreqMHz();
+    Serial.println("Realtime profile (us):   worst    mean   calls");
+    for (int i = 0; i < PROFILE_SLOT_COUNT; i++)
+    {
+        const ProfileStats &stats = profileStats[i];
+        Serial.printf("  %-20s %7u %7u %7u\n", slotNames[i],
+                      stats.maxCycles / cyclesPerUs,
+                      stats.calls ? stats.totalCycles / stats.calls / cyclesPerUs : 0,
+                      stats.calls);
+    }
+    Serial.printf("  beat LED worst lateness %lu us\n", realtimeCore.getMaxLedLateness());
+}
+
+#endif
@@ -0,0 +1,182 @@
+#include "realtime.h"
+#include "config.h"
+#include "profiler.h"
+
+RealtimeCore realtimeCore;
+
+// timer1 at TIM_DIV16 counts 5 ticks per us and holds 23 bits
+#define TIMER_TICKS_PER_US 5
+#define TIMER_MAX_TICKS 0x7FFFFF
+
+enum LedState : uint8_t
+{
+    LED_IDLE,
+    LED_ARMED,
+    LED_PULSE
+};
+
+// Everything the ISRs touch lives in DRAM
+static volatile uint8_t ledState = LED_IDLE;
+static volatile uint32_t armedTime;
+static volatile bool nextPending = false;
+static volatile uint32_t nextFireTime;
+static volatile uint32_t maxLedLateness = 0;
+static volatile bool firePending = false;
+static volatile uint32_t firedTime;
+static volatile uint32_t firedScheduled;
+
+static volatile EdgeEvent edgeQueue[EDGE_QUEUE_SIZE];
+static volatile uint8_t edgeHead = 0;
+static volatile uint8_t edgeTail = 0;
+
+static void IRAM_ATTR armTimer(uint32_t fireTime)
+{
+    int32_t delay = fireTime - micros();
+    uint32_t ticks = delay < 1 ? TIMER_TICKS_PER_US : (uint32_t)delay * TIMER_TICKS_PER_US;
+    timer1_write(ticks > TIMER_MAX_TICKS ? TIMER_MAX_TICKS : ticks);
+}
+
+static void IRAM_ATTR startPulse()
+{
+    GPOS = 1 << LED_PIN;
+    uint32_t now = micros();
+
+    uint32_t lateness = now - armedTime;
+    if (lateness > maxLedLateness)
+    {
+        maxLedLateness = lateness;
+    }
+
+    // Kept for loop() to trace, the ISR can't
+    firedTime = now;
+    firedScheduled = armedTime;
+    firePending = true;
+
+    ledState = LED_PULSE;
+    armTimer(now + BEAT_PULSE_LENGTH);
+}
+
+static void IRAM_ATTR beatTimerIsr()
+{
+    PROFILE_SCOPE(PROFILE_BEAT_ISR);
+
+    if (ledState == LED_ARMED)
+    {
+        // Long intervals are armed in several hops
+        if ((int32_t)(micros() - armedTime) < 0)
+        {
+            armTimer(armedTime);
+            return;
+        }
+        startPulse();
+    }
+    else if (ledState == LED_PULSE)
+    {
+        GPOC = 1 << LED_PIN;
+        ledState = LED_IDLE;
+
+        if (nextPending)
+        {
+            nextPending = false;
+            armedTime = nextFireTime;
+            ledState = LED_ARMED;
+            armTimer(armedTime);
+        }
+    }
+}
+
+static void IRAM_ATTR edgeIsr()
+{
+    PROFILE_SCOPE(PROFILE_EDGE_ISR);
+
+    uint8_t next = (edgeHead + 1) % EDGE_QUEUE_SIZE;
+    if (next == edgeTail)
+    {
+        return; // Full, Buttons falls back to polling the pins
+    }
+
+    edgeQueue[edgeHead].time = millis();
+    edgeQueue[edgeHead].levels = GPI;
+    edgeHead = next;
+}
+
+void RealtimeCore::begin()
+{
+    timer1_attachInterrupt(beatTimerIsr);
+    timer1_enable(TIM_DIV16, TIM_EDGE, TIM_SINGLE);
+
+    attachInterrupt(digitalPinToInterrupt(LEFT_SWITCH_PIN), edgeIsr, CHANGE);
+    attachInterrupt(digitalPinToInterrupt(RIGHT_SWITCH_PIN), edgeIsr, CHANGE);
+}
+
+void IRAM_ATTR RealtimeCore::scheduleLed(unsigned long fireTime)
+{
+    uint32_t savedState = xt_rsil(15);
+
+    // A beat that is already due must not be replaced by the next one
+    if (ledState == LED_ARMED && (int32_t)(micros() - armedTime) >= 0)
+    {
+        startPulse();
+    }
+
+    if (ledState == LED_PULSE)
+    {
+        nextFireTime = fireTime;
+        nextPending = true;
+    }
+    else
+    {
+        armedTime = fireTime;
+        ledState = LED_ARMED;
+        armTimer(fireTime);
+    }
+
+    xt_wsr_ps(savedState);
+}
+
+void IRAM_ATTR RealtimeCore::cancelLed()
+{
+    uint32_t savedState = xt_rsil(15);
+    ledState = LED_IDLE;
+    nextPending = false;
+    GPOC = 1 << LED_PIN;
+    xt_wsr_ps(savedState);
+}
+
+bool RealtimeCore::popEdge(EdgeEvent &edge)
+{
+    if (edgeTail == edgeHead)
+    {
+        return false;
+    }
+
+    edge.time = edgeQueue[edgeTail].time;
+    edge.levels = edgeQueue[edgeTail].levels;
+    edgeTail = (edgeTail + 1) % EDGE_QUEUE_SIZE;
+    return true;
+}
+
+bool RealtimeCore::takeLedFire(LedFire &fire)
+{
+    if (!firePending)
+    {
+        return false;
+    }
+
+    uint32_t savedState = xt_rsil(15);
+    fire.time = firedTime;
+    fire.scheduled = firedScheduled;
+    firePending = false;
+    xt_wsr_ps(savedState);
+    return true;
+}
+
+unsigned long RealtimeCore::getMaxLedLateness() const
+{
+    return maxLedLateness;
+}
+
+void RealtimeCore::resetLedLateness()
+{
+    maxLedLateness = 0;
+}
@@ -0,0 +1,92 @@
+#include "rtc_state.h"
+#include "config.h"
+#include "crc.h"
+#include "debug.h"
+
+extern "C"
+{
+#include <user_interface.h>
+}
+
+RtcState rtcState;
+
+RtcState::RtcState()
+{
+    memset((void *)&checkpoint, 0, sizeof(checkpoint));
+}
+
+bool RtcState::begin()
+{
+    bool valid = read();
+    uint32_t reason = ESP.getResetInfoPtr()->reason;
+
+    // Power-on leaves garbage in RTC memory, which the CRC rejects. Deep sleep
+    // wake-ups are deliberate and start fresh.
+    bool resume = valid && reason != REASON_DEEP_SLEEP_AWAKE;
+
+    DEBUG_PRINTF("Reset reason %d, checkpoint %s\n", reason, valid ? "valid" : "invalid");
+
+    // From here on the checkpoint tracks the new session
+    checkpoint.magic = RTC_STATE_MAGIC;
+    checkpoint.rtcPeriod = system_rtc_clock_cali_proc();
+    if (!resume)
+    {
+        checkpoint.mode = PATCH_MODE;
+        checkpoint.patch = 0;
+        memset((void *)&checkpoint.beat, 0, sizeof(checkpoint.beat));
+        checkpoint.lastBeatRtc = system_get_rtc_time();
+    }
+
+    return resume;
+}
+
+unsigned long RtcState::getTimeSinceLastBeat() const
+{
+    uint32_t ticks = system_get_rtc_time() - checkpoint.lastBeatRtc;
+    return ((uint64_t)ticks * checkpoint.rtcPeriod) >> 12;
+}
+
+// The beat state moves once a beat and on tempo changes. lastBeat moves with
+// it, setTempo() stretching a beat moves it without a beat going out, so its
+// time is taken back from when loop() got here whenever the state changed.
+void RtcState::update(Mode mode, int patch, const BeatState &beat, unsigned long lastBeat)
+{
+    bool beatChanged = memcmp(&checkpoint.beat, &beat, sizeof(beat)) != 0;
+    if (!beatChanged && checkpoint.mode == mode && checkpoint.patch == patch)
+    {
+        return;
+    }
+
+    if (beatChanged)
+    {
+        memcpy((void *)&checkpoint.beat, (const void *)&beat, sizeof(beat));
+        uint32_t sinceBeat = micros() - lastBeat;
+        checkpoint.lastBeatRtc = system_get_rtc_time() - ((uint64_t)sinceBeat << 12) / checkpoint.rtcPeriod;
+    }
+    checkpoint.mode = mode;
+    checkpoint.patch = patch;
+    write();
+}
+
+void RtcState::clear()
+{
+    memset((void *)&checkpoint, 0, sizeof(checkpoint));
+    ESP.rtcUserMemoryWrite(RTC_STATE_OFFSET, (uint32_t *)&checkpoint, sizeof(checkpoint));
+}
+
+bool RtcState::read()
+{
+    if (!ESP.rtcUserMemoryRead(RTC_STATE_OFFSET, (uint32_t *)&checkpoint, sizeof(checkpoint)))
+    {
+        return false;
+    }
+
+    return checkpoint.magic == RTC_STATE_MAGIC &&
+           checkpoint.crc == crc32(&checkpoint, offsetof(RtcCheckpoint, crc));
+}
+
+void RtcState::write()
+{
+    checkpoint.crc = crc32(&checkpoint, offsetof(RtcCheckpoint, crc));
+    ESP.rtcUserMemoryWrite(RTC_STATE_OFFSET, (uint32_t *)&checkpoint, sizeof(checkpoint));
+}
@@ -0,0 +1,268 @@
+#include "serial_control.h"
+#include "crc.h"
+
+static void putU16(uint8_t *data, uint16_t value)
+{
+    data[0] = value & 0xFF;
+    data[1] = value >> 8;
+}
+
+static void putU32(uint8_t *data, uint32_t value)
+{
+    putU16(data, value & 0xFFFF);
+    putU16(data + 2, value >> 16);
+}
+
+SerialControl::SerialControl(Stream &port) : port(port),
+                                             state(WAIT_SYNC),
+                                             frameType(0),
+                                             frameLength(0),
+                                             received(0),
+                                             crc(0),
+                                             queueHead(0),
+                                             queueCount(0),
+                                             queryPending(false),
+                                             statsPending(false),
+                                             stallsPending(false),
+                                             streaming(false)
+{
+}
+
+bool SerialControl::update()
+{
+    STALL_SCOPE(STALL_SERIAL);
+    while (port.available() > 0)
+    {
+        parse(port.read());
+    }
+
+    return queueCount > 0;
+}
+
+// A bad length or checksum drops back to hunting for the next sync byte
+void SerialControl::parse(uint8_t byte)
+{
+    switch (state)
+    {
+    case WAIT_SYNC:
+        if (byte == SERIAL_SYNC)
+        {
+            crc = 0;
+            state = READ_TYPE;
+        }
+        break;
+    case READ_TYPE:
+        frameType = byte;
+        crc = crc8(&byte, 1, crc);
+        state = READ_LENGTH;
+        break;
+    case READ_LENGTH:
+        frameLength = byte;
+        received = 0;
+        crc = crc8(&byte, 1, crc);
+        if (frameLength > SERIAL_MAX_PAYLOAD)
+        {
+            state = WAIT_SYNC;
+        }
+        else
+        {
+            state = frameLength ? READ_PAYLOAD : READ_CHECKSUM;
+        }
+        break;
+    case READ_PAYLOAD:
+        payload[received++] = byte;
+        crc = crc8(&byte, 1, crc);
+        if (received == frameLength)
+        {
+            state = READ_CHECKSUM;
+        }
+        break;
+    case READ_CHECKSUM:
+        state = WAIT_SYNC;
+        if (byte != crc)
+        {
+            sendNak((SerialFrameType)frameType, SERIAL_ERROR_CHECKSUM);
+            return;
+        }
+        dispatch();
+        break;
+    }
+}
+
+void SerialControl::dispatch()
+{
+    SerialCommand command = {(SerialFrameType)frameType, 0, TEMPO_NEXT_BEAT};
+
+    switch (frameType)
+    {
+    case SERIAL_SET_TEMPO:
+        if (frameLength != 2 && frameLength != 3)
+        {
+            sendNak(command.type, SERIAL_ERROR_BAD_VALUE);
+            return;
+        }
+        command.value = payload[0] | (payload[1] << 8);
+        if (frameLength == 3)
+        {
+            command.when = (TempoChange)payload[2];
+        }
+        if (command.value < 40 || command.value > 240 || command.when > TEMPO_NEXT_BAR)
+        {
+            sendNak(command.type, SERIAL_ERROR_BAD_VALUE);
+            return;
+        }
+        break;
+    case SERIAL_SELECT_PATCH:
+        if (frameLength != 1 || payload[0] >= MAX_PATCHES)
+        {
+            sendNak(command.type, SERIAL_ERROR_BAD_VALUE);
+            return;
+        }
+        command.value = payload[0];
+        break;
+    case SERIAL_START:
+    case SERIAL_STOP:
+        break;
+    case SERIAL_QUERY:
+        queryPending = true;
+        return;
+    case SERIAL_GET_STATS:
+        statsPending = true;
+        return;
+    case SERIAL_GET_STALLS:
+        stallsPending = true;
+        return;
+    case SERIAL_STREAM:
+        streaming = frameLength == 1 && payload[0] != 0;
+        sendAck(command.type, micros());
+        return;
+    default:
+        sendNak(command.type, SERIAL_ERROR_UNKNOWN_TYPE);
+        return;
+    }
+
+    if (queueCount == SERIAL_QUEUE_SIZE)
+    {
+        sendNak(command.type, SERIAL_ERROR_QUEUE_FULL);
+        return;
+    }
+
+    queue[(queueHead + queueCount) % SERIAL_QUEUE_SIZE] = command;
+    queueCount++;
+}
+
+bool SerialControl::nextCommand(SerialCommand &command)
+{
+    if (queueCount == 0)
+    {
+        return false;
+    }
+
+    command = queue[queueHead];
+    queueHead = (queueHead + 1) % SERIAL_QUEUE_SIZE;
+    queueCount--;
+    return true;
+}
+
+bool SerialControl::takeQuery()
+{
+    bool pending = queryPending;
+    queryPending = false;
+    return pending;
+}
+
+bool SerialControl::takeStatsQuery()
+{
+    bool pending = statsPending;
+    statsPending = false;
+    return pending;
+}
+
+bool SerialControl::takeStallsQuery()
+{
+    bool pending = stallsPending;
+    stallsPending = false;
+    return pending;
+}
+
+void SerialControl::sendAck(SerialFrameType type, unsigned long time)
+{
+    uint8_t data[5];
+    data[0] = type;
+    putU32(data + 1, time);
+    send(SERIAL_ACK, data, sizeof(data));
+}
+
+void SerialControl::sendNak(SerialFrameType type, SerialError error)
+{
+    uint8_t data[2] = {type, error};
+    send(SERIAL_NAK, data, sizeof(data));
+}
+
+void SerialControl::sendState(Mode mode, int patch, bool running, int tempo, unsigned long timeToNextBeat)
+{
+    uint8_t data[7];
+    data[0] = mode;
+    data[1] = patch;
+    data[2] = running;
+    putU16(data + 3, tempo);
+    putU16(data + 5, min(timeToNextBeat, 0xFFFFUL));
+    send(SERIAL_STATE, data, sizeof(data));
+}
+
+void SerialControl::sendBeat(unsigned long beatTime, int tempo, int patch)
+{
+    if (!streaming)
+    {
+        return;
+    }
+
+    uint8_t data[7];
+    putU32(data, beatTime);
+    putU16(data + 4, tempo);
+    data[6] = patch;
+    send(SERIAL_BEAT, data, sizeof(data));
+}
+
+void SerialControl::sendStats(unsigned long bootTime, unsigned long meanLoop, unsigned long worstLoop)
+{
+    uint8_t data[8];
+    putU32(data, bootTime);
+    putU16(data + 4, min(meanLoop, 0xFFFFUL));
+    putU16(data + 6, min(worstLoop, 0xFFFFUL));
+    send(SERIAL_STATS, data, sizeof(data));
+}
+
+void SerialControl::sendStalls(uint32_t stallCount, const StallRecord *worst, int count, uint8_t boot)
+{
+    uint8_t data[11];
+    data[0] = count;
+    putU32(data + 1, stallCount);
+    putU32(data + 5, STALL_BUDGET_US);
+    send(SERIAL_STALLS, data, 9);
+
+    for (int i = 0; i < count; i++)
+    {
+        data[0] = worst[i].subsystem;
+        data[1] = worst[i].flags;
+        data[2] = boot - worst[i].boot;
+        putU32(data + 3, worst[i].length);
+        putU32(data + 7, worst[i].pc);
+        send(SERIAL_STALL, data, sizeof(data));
+    }
+}
+
+// Written as one block so the UART gets it in a single FIFO fill
+void SerialControl::send(SerialFrameType type, const uint8_t *data, uint8_t length)
+{
+    STALL_SCOPE(STALL_SERIAL);
+    uint8_t frame[SERIAL_MAX_PAYLOAD + 4];
+    frame[0] = SERIAL_SYNC;
+    frame[1] = type;
+    frame[2] = length;
+
+    memcpy(frame + 3, data, length);
+    frame[3 + length] = crc8(frame + 1, length + 2);
+
+    port.write(frame, length + 4);
+}
@@ -0,0 +1,251 @@
+#include "stall_watch.h"
+#include "rtc_state.h"
+#include "debug.h"
+
+StallWatch stallWatch;
+
+// Ring in RTC user memory: STALL_MAGIC, head | boots << 16, then the records.
+// Written through RTC_USER_MEM, the SDK's rtc_mem calls run from flash and
+// can't be used from the interrupt.
+#define STALL_HEADER_WORDS 2
+#define STALL_RECORD_WORDS (sizeof(StallRecord) / 4)
+#define RTC_USER_WORDS 128
+#define STALL_RING (RTC_USER_MEM + RTC_STALL_OFFSET)
+
+static_assert(RTC_STATE_OFFSET + sizeof(RtcCheckpoint) / 4 <= RTC_STALL_OFFSET,
+              "Stall ring overlaps the RTC checkpoint");
+static_assert(RTC_STALL_OFFSET + STALL_HEADER_WORDS + STALL_RING_SIZE * STALL_RECORD_WORDS <= RTC_USER_WORDS,
+              "Stall ring does not fit RTC user memory");
+
+union StallWords
+{
+    StallRecord record;
+    uint32_t words[STALL_RECORD_WORDS];
+};
+
+static const char *const subsystemNames[STALL_SUBSYSTEM_COUNT] = {
+    "loop", "metronome", "buttons", "display", "storage", "wifi", "web", "serial"};
+
+static uint8_t IRAM_ATTR recordCheck(const StallRecord &record)
+{
+    uint32_t folded = record.pc ^ record.length ^ record.subsystem ^ (record.boot << 8) ^ (record.flags << 16);
+    folded ^= folded >> 16;
+    folded ^= folded >> 8;
+    return (folded & 0xFF) ^ 0x5A;
+}
+
+// A level-1 interrupt leaves the PC it interrupted in EPC1
+static inline uint32_t IRAM_ATTR interruptedPc()
+{
+#ifdef __XTENSA__
+    uint32_t pc;
+    __asm__ __volatile__("rsr %0, epc1" : "=a"(pc));
+    return pc;
+#else
+    return 0;
+#endif
+}
+
+StallWatch::StallWatch() : active(STALL_LOOP),
+                           budgetCycles(0),
+                           sampleCycles(0),
+                           passStart(0),
+                           stalled(false),
+                           head(0),
+                           boots(0),
+                           slot(0),
+                           stallCount(0)
+{
+    memset(&current, 0, sizeof(current));
+    memset(samples, 0, sizeof(samples));
+    memset(stats, 0, sizeof(stats));
+}
+
+void StallWatch::begin()
+{
+    // Power-on leaves garbage, which the magic and the record checks reject
+    volatile uint32_t *ring = STALL_RING;
+    if (ring[0] == STALL_MAGIC)
+    {
+        head = ring[1] & 0xFFFF;
+        boots = (ring[1] >> 16) + 1;
+    }
+    ring[0] = STALL_MAGIC;
+    writeHeader();
+
+    for (int i = 0, count = getRecordCount(); i < count; i++)
+    {
+        StallRecord record;
+        if (readRecord((head - count + i) % STALL_RING_SIZE, record) && (uint8_t)(boots - record.boot) == 1)
+        {
+            DEBUG_PRINTF("Stall before reset: %lu us in %s at 0x%08x%s\n", (unsigned long)record.length,
+                         getName(record.subsystem), record.pc,
+                         record.flags & STALL_FLAG_ENDED ? "" : ", reset during it");
+        }
+    }
+
+    uint32_t cyclesPerUs = ESP.getCpuFreqMHz();
+    budgetCycles = STALL_BUDGET_US * cyclesPerUs;
+    sampleCycles = STALL_SAMPLE_US * cyclesPerUs;
+    timer0_isr_init();
+    timer0_attachInterrupt(onTimer);
+    newPass();
+}
+
+void StallWatch::newPass()
+{
+    uint32_t savedPs = xt_rsil(15);
+    uint32_t now = micros();
+    bool ended = stalled;
+    if (ended)
+    {
+        stalled = false;
+        current.length = now - passStart;
+        current.flags |= STALL_FLAG_ENDED;
+        writeRecord();
+    }
+    passStart = now;
+    timer0_write(ESP.getCycleCount() + budgetCycles);
+    xt_wsr_ps(savedPs);
+
+    if (!ended)
+    {
+        return;
+    }
+
+    StallStats &blamed = stats[current.subsystem];
+    blamed.count++;
+    if (current.length > blamed.worst)
+    {
+        blamed.worst = current.length;
+        blamed.worstPc = current.pc;
+    }
+    stallCount++;
+    DEBUG_PRINTF("Loop stall: %lu us in %s at 0x%08x\n", (unsigned long)current.length,
+                 getName(current.subsystem), current.pc);
+}
+
+void StallWatch::clear()
+{
+    uint32_t savedPs = xt_rsil(15);
+    head = 0;
+    boots = 0;
+    stalled = false;
+    STALL_RING[0] = STALL_MAGIC;
+    writeHeader();
+    xt_wsr_ps(savedPs);
+
+    memset(stats, 0, sizeof(stats));
+    stallCount = 0;
+}
+
+// Runs once the pass is STALL_BUDGET_US old, then every STALL_SAMPLE_US
+// until newPass(). The record is rewritten on every sample so a reset loses
+// at most one sample of it.
+void IRAM_ATTR StallWatch::onTimer()
+{
+    StallWatch &watch = stallWatch;
+    uint8_t subsystem = watch.active;
+
+    if (!watch.stalled)
+    {
+        watch.stalled = true;
+        watch.slot = watch.head % STALL_RING_SIZE;
+        if (++watch.head == 0)
+        {
+            watch.head = STALL_RING_SIZE; // Same slot, and still reads as full
+        }
+        watch.writeHeader();
+        for (int i = 0; i < STALL_SUBSYSTEM_COUNT; i++)
+        {
+            watch.samples[i] = 0;
+        }
+        watch.current.subsystem = subsystem;
+        watch.current.boot = watch.boots;
+        watch.current.flags = 0;
+    }
+
+    // Blame goes where most samples landed, the first there on a tie
+    uint16_t count = ++watch.samples[subsystem];
+    if (subsystem == watch.current.subsystem || count > watch.samples[watch.current.subsystem])
+    {
+        watch.current.subsystem = subsystem;
+        watch.current.pc = interruptedPc();
+    }
+    watch.current.length = micros() - watch.passStart;
+    watch.writeRecord();
+
+    timer0_write(ESP.getCycleCount() + watch.sampleCycles);
+}
+
+void IRAM_ATTR StallWatch::writeHeader()
+{
+    STALL_RING[1] = head | (uint32_t)boots << 16;
+}
+
+void IRAM_ATTR StallWatch::writeRecord()
+{
+    current.check = recordCheck(current);
+    StallWords copy;
+    copy.record = current;
+    volatile uint32_t *words = STALL_RING + STALL_HEADER_WORDS + slot * STALL_RECORD_WORDS;
+    for (size_t i = 0; i < STALL_RECORD_WORDS; i++)
+    {
+        words[i] = copy.words[i];
+    }
+}
+
+bool StallWatch::readRecord(int index, StallRecord &record) const
+{
+    StallWords copy;
+    volatile uint32_t *words = STALL_RING + STALL_HEADER_WORDS + index * STALL_RECORD_WORDS;
+    uint32_t savedPs = xt_rsil(15);
+    for (size_t i = 0; i < STALL_RECORD_WORDS; i++)
+    {
+        copy.words[i] = words[i];
+    }
+    xt_wsr_ps(savedPs);
+
+    record = copy.record;
+    return record.check == recordCheck(record) && record.subsystem < STALL_SUBSYSTEM_COUNT;
+}
+
+const char *StallWatch::getName(uint8_t subsystem) const
+{
+    return subsystem < STALL_SUBSYSTEM_COUNT ? subsystemNames[subsystem] : "?";
+}
+
+int StallWatch::getRecordCount() const
+{
+    return min((int)head, STALL_RING_SIZE);
+}
+
+int StallWatch::getWorst(StallRecord *worst, int max) const
+{
+    int found = 0;
+    for (int i = 0, count = getRecordCount(); i < count; i++)
+    {
+        StallRecord record;
+        if (!readRecord(i, record))
+        {
+            continue;
+        }
+
+        // Insertion into the sorted list, it holds a handful
+        int position = min(found, max);
+        while (position > 0 && worst[position - 1].length < record.length)
+        {
+            if (position < max)
+            {
+                worst[position] = worst[position - 1];
+            }
+            position--;
+        }
+        if (position < max)
+        {
+            worst[position] = record;
+            found = min(found + 1, max);
+        }
+    }
+    return found;
+}
@@ -1,36 +1,226 @@
 #include "storage.h"
+#include "debug.h"
+#include "trace.h"
+#include "stall_watch.h"
+#include "crc.h"
+#include "tempo_curve.h"
 
 Storage storage;
 
-Storage::Storage() : numPatches(3)
+int defaultPatches(Patch *patches)
 {
+    memset(patches, 0, MAX_PATCHES * sizeof(Patch));
+    strncpy(patches[0].name, "NINT", 5);
+    patches[0].tempo = 90;
+
+    strncpy(patches[1].name, "HUND", 5);
+    patches[1].tempo = 100;
+
+    strncpy(patches[2].name, "TWTY", 5);
+    patches[2].tempo = 120;
+
+    for (int i = 3; i < MAX_PATCHES; i++)
+    {
+        patches[i].tempo = 120;
+    }
+    return 3;
+}
+
+#if FEATURE_STORAGE
+Storage::Storage() : numPatches(3),
+                     elidedWrites(0),
+                     commitCount(0)
+{
+    memset(&header, 0, sizeof(header));
+}
+
+static uint32_t headerCrc(const StoreHeader &header)
+{
+    return crc32(&header, offsetof(StoreHeader, crc));
+}
+
+// A header from a later version is fine as long as its records fit
+static bool headerValid(const StoreHeader &header)
+{
+    return header.magic == STORE_MAGIC &&
+           header.crc == headerCrc(header) &&
+           header.version >= STORE_VERSION &&
+           header.recordSize >= sizeof(PackedPatch) &&
+           STORE_RECORDS_ADDR + (size_t)header.count * header.recordSize <= STORAGE_SIZE;
+}
+
+// The record as it is written to flash, with everything a flat patch doesn't
+// use zeroed so equal patches always give equal bytes
+static PackedPatch packPatch(const Patch &patch)
+{
+    PackedPatch record;
+    memset(&record, 0, sizeof(record));
+    memcpy(record.name, patch.name, sizeof(record.name));
+    // Q8.8 holds up to 255 BPM, past it the tempo would wrap
+    record.tempo = constrain(patch.tempo, 40, 240) << PACKED_TEMPO_SHIFT;
+    if (patch.curve.type != CURVE_NONE && validateCurve(patch.curve))
+    {
+        record.flags = patch.curve.type & PATCH_FLAG_CURVE_MASK;
+        record.endTempo = patch.curve.endTempo;
+        record.bars = patch.curve.bars;
+        record.step = patch.curve.step;
+    }
+    record.crc = crc32(&record.name, sizeof(record) - sizeof(record.crc));
+    return record;
+}
+
+static Patch unpackPatch(const PackedPatch &record)
+{
+    Patch patch;
+    memset(&patch, 0, sizeof(patch));
+    memcpy(patch.name, record.name, sizeof(record.name));
+    patch.tempo = (record.tempo + (1 << (PACKED_TEMPO_SHIFT - 1))) >> PACKED_TEMPO_SHIFT;
+    patch.curve.type = record.flags & PATCH_FLAG_CURVE_MASK;
+    if (patch.curve.type != CURVE_NONE)
+    {
+        patch.curve.endTempo = record.endTempo;
+        patch.curve.bars = record.bars;
+        patch.curve.step = record.step;
+    }
+    return patch;
 }
 
 void Storage::begin()
 {
-    EEPROM.begin(512);
+    EEPROM.begin(STORAGE_SIZE);
+    EEPROM.get(STORE_HEADER_ADDR, header);
+    if (header.magic != STORE_MAGIC)
+    {
+        upgradeLegacy();
+    }
+    else if (!headerValid(header))
+    {
+        recoverHeader();
+    }
     DEBUG_PRINTLN("Storage system initialized");
 }
 
+// Reads whatever the layout from before the header still holds, then writes
+// it back in the current one with a single commit. Anything damaged falls
+// back to the defaults, as it did when that firmware loaded it.
+void Storage::upgradeLegacy()
+{
+    DEBUG_PRINTLN("No patch store header, upgrading the legacy layout");
+
+    Settings settings = getDefaultSettings();
+    LegacySettings legacySettings;
+    EEPROM.get(LEGACY_SETTINGS_ADDR, legacySettings);
+    if (legacySettings.checksum == crc32(&legacySettings.brightness, sizeof(legacySettings.brightness)) ||
+        legacySettings.checksum == LEGACY_SETTINGS_CHECKSUM)
+    {
+        settings.brightness = legacySettings.brightness;
+    }
+
+    uint32_t crcs[MAX_PATCHES];
+    EEPROM.get(LEGACY_CRC_ADDR, crcs);
+    LegacyCurveTable curveTable;
+    EEPROM.get(LEGACY_CURVE_ADDR, curveTable);
+    bool curvesValid = curveTable.crc == crc32(curveTable.curves, sizeof(curveTable.curves));
+
+    Patch patches[MAX_PATCHES];
+    int count = 0;
+    for (int i = 0; i < MAX_PATCHES; i++)
+    {
+        LegacyPatchRecord record;
+        EEPROM.get(LEGACY_PATCHES_ADDR + i * sizeof(record), record);
+        if (crcs[i] != crc32(&record, sizeof(record)) && crcs[i] != LEGACY_CRC_UNWRITTEN)
+        {
+            continue;
+        }
+
+        Patch patch;
+        memset(&patch, 0, sizeof(patch));
+        memcpy(patch.name, record.name, sizeof(patch.name) - 1);
+        patch.tempo = record.tempo;
+        if (curvesValid)
+        {
+            const LegacyCurve &curve = curveTable.curves[i];
+            patch.curve = {curve.type, curve.step, curve.bars, curve.endTempo};
+        }
+        if (!validateCurve(patch.curve))
+        {
+            memset(&patch.curve, 0, sizeof(patch.curve));
+        }
+        if (validatePatch(patch))
+        {
+            patches[count++] = patch;
+        }
+    }
+
+    // Clear what the records don't cover, a damaged header must not bring
+    // stale patches back
+    size_t newEnd = STORE_RECORDS_ADDR + MAX_PATCHES * sizeof(PackedPatch);
+    size_t legacyEnd = LEGACY_CURVE_ADDR + sizeof(LegacyCurveTable);
+    memset(EEPROM.getDataPtr() + newEnd, 0, legacyEnd - newEnd);
+
+    memset(&header, 0, sizeof(header));
+    header.brightness = settings.brightness;
+    if (count == 0)
+    {
+        initializeDefaultPatches(patches);
+        return;
+    }
+
+    savePatches(patches, count);
+    DEBUG_PRINTF("Upgraded %d patches\n", count);
+}
+
+// The magic says the sector is in this layout but the header is damaged, so
+// the records are still where this version puts them. Every one whose CRC32
+// holds is kept and a new header is written for them.
+void Storage::recoverHeader()
+{
+    DEBUG_PRINTLN("Patch store header is corrupt, recovering the records");
+
+    const uint8_t *data = EEPROM.getConstDataPtr();
+    Patch patches[MAX_PATCHES];
+    int count = 0;
+    for (int i = 0; i < MAX_PATCHES; i++)
+    {
+        PackedPatch record;
+        memcpy(&record, data + STORE_RECORDS_ADDR + i * sizeof(record), sizeof(record));
+        Patch patch = unpackPatch(record);
+        if (record.crc != crc32(&record.name, sizeof(record) - sizeof(record.crc)) || !validatePatch(patch))
+        {
+            continue;
+        }
+        if (!validateCurve(patch.curve))
+        {
+            memset(&patch.curve, 0, sizeof(patch.curve));
+        }
+        patches[count++] = patch;
+    }
+
+    // The brightness may be the damaged byte
+    uint8_t brightness = header.brightness <= 15 ? header.brightness : getDefaultSettings().brightness;
+    memset(&header, 0, sizeof(header));
+    header.brightness = brightness;
+    if (count == 0)
+    {
+        initializeDefaultPatches(patches);
+        return;
+    }
+
+    savePatches(patches, count);
+    DEBUG_PRINTF("Recovered %d patches\n", count);
+}
+
 Settings Storage::getDefaultSettings()
 {
     Settings settings;
     settings.brightness = 1; // Low brightness
-    settings.checksum = SETTINGS_CHECKSUM;
     return settings;
 }
 
 Settings Storage::loadSettings()
 {
     Settings settings;
-    EEPROM.get(SETTINGS_ADDR, settings);
-
-    if (settings.checksum != SETTINGS_CHECKSUM)
-    {
-        DEBUG_PRINTLN("Invalid settings, initializing defaults");
-        settings = getDefaultSettings();
-        saveSettings(settings);
-    }
+    settings.brightness = header.brightness;
 
     DEBUG_PRINTF("Loaded settings - Brightness: %d\n", settings.brightness);
 
@@ -39,8 +229,21 @@ Settings Storage::loadSettings()
 
 void Storage::saveSettings(const Settings &settings)
 {
-    EEPROM.put(SETTINGS_ADDR, settings);
-    EEPROM.commit();
+    if (settings.brightness == header.brightness)
+    {
+        elidedWrites++;
+        return;
+    }
+
+    header.brightness = settings.brightness;
+    putHeader();
+    commit();
+}
+
+void Storage::putHeader()
+{
+    header.crc = headerCrc(header);
+    EEPROM.put(STORE_HEADER_ADDR, header);
 }
 
 bool Storage::validatePatch(const Patch &patch)
@@ -63,61 +266,99 @@ bool Storage::validatePatch(const Patch &patch)
 
 void Storage::initializeDefaultPatches(Patch *patches)
 {
-    strncpy(patches[0].name, "NINT", 5);
-    patches[0].tempo = 90;
-
-    strncpy(patches[1].name, "HUND", 5);
-    patches[1].tempo = 100;
+    savePatches(patches, defaultPatches(patches));
+}
 
-    strncpy(patches[2].name, "TWTY", 5);
-    patches[2].tempo = 120;
+// Each record is checked on its own. A bad one is dropped and the rest
+// move up, only a table with nothing usable left falls back to the defaults.
+void Storage::loadPatches(Patch *patches, int maxPatches)
+{
+    const uint8_t *data = EEPROM.getConstDataPtr();
+    int stored = min((int)header.count, maxPatches);
+    bool changed = header.count > maxPatches;
+    int count = 0;
 
-    for (int i = 3; i < MAX_PATCHES; i++)
+    for (int i = 0; i < stored; i++)
     {
-        patches[i].name[0] = '\0';
-        patches[i].tempo = 120;
-    }
+        // Records of a later version are longer, only the start is ours
+        const uint8_t *bytes = data + STORE_RECORDS_ADDR + i * header.recordSize;
+        PackedPatch record;
+        memcpy(&record, bytes, sizeof(record));
+        Patch patch = unpackPatch(record);
 
-    numPatches = 3;
-    savePatches(patches, MAX_PATCHES);
-}
+        if (record.crc != crc32(bytes + sizeof(record.crc), header.recordSize - sizeof(record.crc)) ||
+            !validatePatch(patch))
+        {
+            DEBUG_PRINTF("Patch %d is corrupt, dropping it\n", i);
+            changed = true;
+            continue;
+        }
 
-void Storage::loadPatches(Patch *patches, int maxPatches)
-{
-    EEPROM.get(PATCHES_ADDR, patches[0]);
+        if (!validateCurve(patch.curve))
+        {
+            memset(&patch.curve, 0, sizeof(patch.curve));
+            changed = true;
+        }
+        patches[count++] = patch;
+    }
 
-    if (!validatePatch(patches[0]))
+    if (count == 0)
     {
-        DEBUG_PRINTLN("Invalid patches found, initializing defaults");
+        DEBUG_PRINTLN("No valid patches found, initializing defaults");
         initializeDefaultPatches(patches);
         return;
     }
 
-    for (int i = 1; i < maxPatches; i++)
+    for (int i = count; i < maxPatches; i++)
     {
-        EEPROM.get(PATCHES_ADDR + (i * sizeof(Patch)), patches[i]);
+        memset(&patches[i], 0, sizeof(patches[i]));
+        patches[i].tempo = 120;
     }
+    numPatches = count;
 
-    numPatches = 0;
-    for (int i = 0; i < maxPatches; i++)
+    if (changed)
     {
-        if (patches[i].name[0] != '\0')
-        {
-            numPatches++;
-        }
+        savePatches(patches, count);
     }
 
     DEBUG_PRINTF("Loaded %d patches\n", numPatches);
 }
 
-void Storage::savePatches(const Patch *patches, int maxPatches)
+// The first count patches are stored, the slots after them are cleared
+void Storage::savePatches(const Patch *patches, int count)
 {
-    DEBUG_PRINTLN("Storage: Saving patches to EEPROM");
-    for (int i = 0; i < maxPatches; i++)
+    PackedPatch records[MAX_PATCHES];
+    memset(records, 0, sizeof(records));
+    count = constrain(count, 0, MAX_PATCHES);
+    for (int i = 0; i < count; i++)
     {
-        EEPROM.put(PATCHES_ADDR + (i * sizeof(Patch)), patches[i]);
+        records[i] = packPatch(patches[i]);
     }
-    if (EEPROM.commit())
+    numPatches = count;
+
+    StoreHeader next = header;
+    next.magic = STORE_MAGIC;
+    next.version = STORE_VERSION;
+    next.count = count;
+    next.recordSize = sizeof(PackedPatch);
+    next.crc = headerCrc(next);
+
+    // Compared against the RAM copy of the sector, which is what flash holds
+    const uint8_t *stored = EEPROM.getConstDataPtr();
+    if (memcmp(stored + STORE_HEADER_ADDR, &next, sizeof(next)) == 0 &&
+        memcmp(stored + STORE_RECORDS_ADDR, records, sizeof(records)) == 0)
+    {
+        DEBUG_PRINTLN("Storage: Patches unchanged, skipping write");
+        elidedWrites++;
+        return;
+    }
+
+    DEBUG_PRINTLN("Storage: Saving patches to EEPROM");
+    header = next;
+    EEPROM.put(STORE_HEADER_ADDR, header);
+    EEPROM.put(STORE_RECORDS_ADDR, records);
+
+    if (commit())
     {
         DEBUG_PRINTLN("Storage: EEPROM commit successful");
     }
@@ -127,14 +368,13 @@ void Storage::savePatches(const Patch *patches, int maxPatches)
     }
 }
 
-void Storage::savePatchCount(int count)
+bool Storage::commit()
 {
-    DEBUG_PRINTF("Storage: Updating patch count from %d to %d\n", numPatches, count);
-    numPatches = count;
+    STALL_SCOPE(STALL_STORAGE);
+    unsigned long commitStart = millis();
+    bool result = EEPROM.commit();
+    commitCount++;
+    trace.record(TRACE_FLASH_COMMIT, 0, traceDuration(millis() - commitStart));
+    return result;
 }
-
-int Storage::getCurrentNumPatches() const
-{
-    DEBUG_PRINTF("Storage: Current patch count is %d\n", numPatches);
-    return numPatches;
-}
\ No newline at end of file
+#endif
@@ -0,0 +1,148 @@
+#include "tempo_curve.h"
+#include "config.h"
+
+// Tempos are BPM in Q8.24, which still fits 32 bits at 240 BPM. reciprocal
+// is 2^RECIPROCAL_SHIFT / tempo, that is 2^37 / BPM, which fits at 40 BPM.
+#define TEMPO_SHIFT 24
+#define RECIPROCAL_SHIFT 61
+#define INTERVAL_SHIFT (RECIPROCAL_SHIFT - TEMPO_SHIFT)
+#define FRACTION_MASK ((1ULL << INTERVAL_SHIFT) - 1)
+
+bool validateCurve(const TempoCurve &curve)
+{
+    switch (curve.type)
+    {
+    case CURVE_NONE:
+        return true;
+    case CURVE_LINEAR:
+        break;
+    case CURVE_STEP:
+        if (curve.step == 0)
+        {
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+
+    return curve.bars > 0 && curve.bars <= 255 && curve.endTempo >= 40 && curve.endTempo <= 240;
+}
+
+TempoRamp::TempoRamp() : active(false),
+                         rising(false),
+                         type(CURVE_NONE),
+                         tempo(0),
+                         playing(0),
+                         delta(0),
+                         remainder(0),
+                         carry(0),
+                         stepSize(0),
+                         endTempo(0),
+                         segmentBeats(0),
+                         beatsLeft(0),
+                         reciprocal(0),
+                         fraction(0)
+{
+}
+
+void TempoRamp::start(int startTempo, const TempoCurve &curve)
+{
+    active = false;
+    int distance = curve.endTempo - startTempo;
+    if (curve.type == CURVE_NONE || !validateCurve(curve) || distance == 0 ||
+        (curve.type == CURVE_STEP && (distance > 0) != (curve.step > 0)))
+    {
+        return;
+    }
+
+    type = curve.type;
+    tempo = playing = (uint32_t)startTempo << TEMPO_SHIFT;
+    endTempo = (uint32_t)curve.endTempo << TEMPO_SHIFT;
+    segmentBeats = (uint32_t)curve.bars * BEATS_PER_BAR;
+    beatsLeft = segmentBeats;
+    rising = distance > 0;
+    int64_t span = (int64_t)distance << TEMPO_SHIFT;
+    delta = span / (int64_t)segmentBeats;
+    remainder = llabs(span % (int64_t)segmentBeats);
+    carry = 0;
+    stepSize = (int32_t)curve.step << TEMPO_SHIFT;
+    fraction = 0;
+    seedReciprocal();
+    active = true;
+}
+
+unsigned long TempoRamp::nextInterval()
+{
+    // 60e6 / BPM, with the fraction of a us the last beat left over
+    uint64_t total = 60000000ULL * reciprocal + fraction;
+    fraction = total & FRACTION_MASK;
+    unsigned long interval = total >> INTERVAL_SHIFT;
+    playing = tempo;
+
+    if (beatsLeft == 0)
+    {
+        return interval; // Holding the end tempo
+    }
+
+    beatsLeft--;
+    if (type == CURVE_LINEAR)
+    {
+        // The carry keeps it exact, beat n is start + distance * n / beats
+        tempo += delta;
+        carry += remainder;
+        if (carry >= segmentBeats)
+        {
+            carry -= segmentBeats;
+            tempo += rising ? 1 : -1;
+        }
+        refineReciprocal();
+    }
+    else if (beatsLeft == 0)
+    {
+        tempo += stepSize;
+        if (rising ? tempo < endTempo : tempo > endTempo)
+        {
+            beatsLeft = segmentBeats;
+        }
+        else
+        {
+            tempo = endTempo;
+        }
+        seedReciprocal();
+    }
+
+    return interval;
+}
+
+// Once per curve and per step, never per beat
+void TempoRamp::seedReciprocal()
+{
+    reciprocal = (1ULL << RECIPROCAL_SHIFT) / tempo;
+}
+
+// Newton's method for 1/tempo, r' = r * (2 - tempo * r), from the last
+// beat's value. A beat of a ramp moves the tempo by well under a percent, so
+// this settles in a couple of steps. Only a ramp that moves the tempo by a
+// quarter in one beat is too far off for it and pays for a division.
+void TempoRamp::refineReciprocal()
+{
+    uint64_t product = (uint64_t)tempo * reciprocal;
+    if (product < (3ULL << (RECIPROCAL_SHIFT - 2)) || product > (5ULL << (RECIPROCAL_SHIFT - 2)))
+    {
+        seedReciprocal();
+        return;
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        product = (uint64_t)tempo * reciprocal;
+        uint64_t error = (2ULL << RECIPROCAL_SHIFT) - product;
+        uint32_t next = ((uint64_t)reciprocal * (error >> 30)) >> (RECIPROCAL_SHIFT - 30);
+        if (next == reciprocal)
+        {
+            return;
+        }
+        reciprocal = next;
+    }
+}
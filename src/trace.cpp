@@ -0,0 +1,3 @@
+#include "trace.h"
+
+TraceRecorder trace;
@@ -1,192 +1,445 @@
 #include "wifi_manager.h"
 #include "storage.h"
+#include "api_json.h"
 #include "debug.h"
+#include "trace.h"
+#include "stall_watch.h"
+#include "web_assets.h"
 #include <ArduinoJson.h>
-#include <LittleFS.h>
+#include <Updater.h>
+#include <Schedule.h>
 
-WiFiManager::WiFiManager(Patch *patches, Settings &settings, Display &display) : server(80),
+#if FEATURE_NETWORK
+
+// Every subsystem blamed at least once, and the longest stalls in the ring
+#define STALLS_JSON_SIZE (JSON_OBJECT_SIZE(4) + JSON_OBJECT_SIZE(STALL_SUBSYSTEM_COUNT) +          \
+                          STALL_SUBSYSTEM_COUNT * JSON_OBJECT_SIZE(3) + JSON_ARRAY_SIZE(STALL_REPORT_COUNT) + \
+                          STALL_REPORT_COUNT * JSON_OBJECT_SIZE(5))
+
+WiFiManager::WiFiManager(PatchTable &patchTable, Settings &settings, Display &display, Metronome &metronome) : server(80),
                                                                                  wifiConnected(false),
-                                                                                 wifiAttempting(false),
+                                                                                 serverStarted(false),
+                                                                                 state(WIFI_BACKOFF),
                                                                                  wifiStartAttemptTime(0),
-                                                                                 patches(patches),
+                                                                                 nextAttemptTime(0),
+                                                                                 backoffDelay(WIFI_BACKOFF_MIN),
+                                                                                 hasCachedAp(false),
+                                                                                 fastPathAttempt(false),
+                                                                                 cachedChannel(0),
+                                                                                 connectionLostTime(0),
+                                                                                 lastReconnectTime(0),
+                                                                                 worstReconnectTime(0),
+                                                                                 reconnectCount(0),
+                                                                                 attemptCount(0),
+                                                                                 otaPending(false),
+                                                                                 otaFailed(false),
+                                                                                 otaBytes(0),
+                                                                                 otaStartTime(0),
+                                                                                 otaThroughput(0),
+                                                                                 httpRequestSeen(false),
+                                                                                 serving(false),
+                                                                                 readCapped(false),
+                                                                                 requestStart(0),
+                                                                                 patchTable(patchTable),
                                                                                  settings(settings),
-                                                                                 display(display)
-{
-}
-
-String getContentType(String filename)
+                                                                                 display(display),
+                                                                                 metronome(metronome)
 {
-    if (filename.endsWith(".html"))
-        return "text/html";
-    if (filename.endsWith(".css"))
-        return "text/css";
-    if (filename.endsWith(".js"))
-        return "application/javascript";
-    return "text/plain";
 }
 
 void WiFiManager::begin()
 {
-    if (!LittleFS.begin())
-    {
-        DEBUG_PRINTLN("Error mounting LittleFS");
-        return;
-    }
+    // Reconnects are driven from update(), and nothing should hit flash
+    WiFi.persistent(false);
+    WiFi.setAutoReconnect(false);
+    WiFi.mode(WIFI_STA);
+
+#ifdef WIFI_STATIC_IP
+    WiFi.config(IPAddress(WIFI_STATIC_IP), IPAddress(WIFI_STATIC_GATEWAY),
+                IPAddress(WIFI_STATIC_SUBNET), IPAddress(WIFI_STATIC_GATEWAY));
+#endif
 
-    DEBUG_PRINT("Starting WiFi connection attempt...");
-    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-    wifiStartAttemptTime = millis();
-    wifiAttempting = true;
     wifiConnected = false;
+    startAttempt();
 
     setupServerRoutes();
 
-    // Handle static files
+    schedule_recurrent_function_us([this]()
+                                   {
+        pollWhileServing();
+        return true; }, HTTP_BEAT_POLL);
+
+    server.addHook([this](const String &, const String &, WiFiClient *, ESP8266WebServer::ContentTypeFunction)
+                   {
+        httpRequestSeen = true;
+        return ESP8266WebServer::CLIENT_REQUEST_CAN_CONTINUE; });
+
     server.onNotFound([this]()
                       {
-        String path = server.uri();
-        DEBUG_PRINT("Requested path: ");
-        DEBUG_PRINTLN(path);
-        
-        if (path.endsWith("/")) {
-            path += "index.html";
-            DEBUG_PRINTLN("Adding index.html to path");
-        }
-        
-        DEBUG_PRINT("Looking for file: ");
-        DEBUG_PRINTLN(path);
-        
-        if (LittleFS.exists(path)) {
-            DEBUG_PRINTLN("File exists!");
-            File file = LittleFS.open(path, "r");
-            server.streamFile(file, getContentType(path));
-            file.close();
-            return;
-        }
-        
-        DEBUG_PRINTLN("File not found!");
+        DEBUG_PRINT("Not found: ");
+        DEBUG_PRINTLN(server.uri());
         server.send(404, "text/plain", "File Not Found"); });
 }
 
+void WiFiManager::startAttempt()
+{
+    fastPathAttempt = hasCachedAp;
+    attemptCount++;
+
+    if (fastPathAttempt)
+    {
+        DEBUG_PRINTF("WiFi fast reconnect on channel %d\n", cachedChannel);
+        WiFi.begin(WIFI_SSID, WIFI_PASSWORD, cachedChannel, cachedBssid);
+    }
+    else
+    {
+        DEBUG_PRINTLN("Starting WiFi connection attempt...");
+        WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+    }
+
+    wifiStartAttemptTime = millis();
+    setState(WIFI_CONNECTING);
+}
+
+void WiFiManager::scheduleRetry()
+{
+    WiFi.disconnect();
+
+    // A failed fast path means the AP moved, so scan right away
+    if (fastPathAttempt)
+    {
+        DEBUG_PRINTLN("Cached AP unreachable, falling back to full scan");
+        hasCachedAp = false;
+        startAttempt();
+        return;
+    }
+
+    DEBUG_PRINTF("WiFi attempt failed, retrying in %lu ms\n", backoffDelay);
+    nextAttemptTime = millis() + backoffDelay;
+    backoffDelay = min(backoffDelay * 2, (unsigned long)WIFI_BACKOFF_MAX);
+    setState(WIFI_BACKOFF);
+}
+
+void WiFiManager::onConnected()
+{
+    wifiConnected = true;
+    setState(WIFI_CONNECTED);
+    backoffDelay = WIFI_BACKOFF_MIN;
+
+    memcpy(cachedBssid, WiFi.BSSID(), sizeof(cachedBssid));
+    cachedChannel = WiFi.channel();
+    hasCachedAp = true;
+
+    if (connectionLostTime != 0)
+    {
+        lastReconnectTime = millis() - connectionLostTime;
+        worstReconnectTime = max(worstReconnectTime, lastReconnectTime);
+        reconnectCount++;
+        connectionLostTime = 0;
+        DEBUG_PRINTF("WiFi reconnected in %lu ms\n", lastReconnectTime);
+    }
+
+    DEBUG_PRINTLN("\nWiFi Connected!");
+    DEBUG_PRINTF("IP address: %s\n", WiFi.localIP().toString().c_str());
+
+    if (!serverStarted)
+    {
+        server.begin();
+        serverStarted = true;
+        DEBUG_PRINTLN("Web server started");
+    }
+}
+
+void WiFiManager::setState(WifiState newState)
+{
+    state = newState;
+    trace.record(TRACE_WIFI_STATE, newState);
+}
+
+void WiFiManager::handleClient()
+{
+    STALL_SCOPE(STALL_WEB);
+    requestStart = millis();
+    httpRequestSeen = false;
+    serving = true;
+    readCapped = true;
+    server.handleClient();
+    serving = false;
+
+    if (httpRequestSeen)
+    {
+        trace.record(TRACE_HTTP_REQUEST, server.method(), traceDuration(millis() - requestStart));
+    }
+}
+
+// The core waits for a client's bytes inside handleClient(), its timed reads
+// spinning on yield(), and recurrent scheduled functions run at every
+// yield(). The beat is kept going from there, and a request that is still
+// arriving after HTTP_REQUEST_TIMEOUT is cut off so one slow client can't
+// hold loop(). The client's timeout alone can't cap it, the wait starts over
+// for every byte, but a read in progress checks it on each pass, so it goes
+// to 0 here first. Drops are traced so the cut-off can be checked on the
+// pedal.
+void WiFiManager::pollWhileServing()
+{
+    if (!serving)
+    {
+        return;
+    }
+    metronome.poll();
+    if (readCapped && millis() - requestStart > HTTP_REQUEST_TIMEOUT && server.client().connected())
+    {
+        DEBUG_PRINTLN("HTTP request too slow, dropping it");
+        server.client().setTimeout(0);
+        server.client().stop();
+        trace.record(TRACE_HTTP_DROPPED, 0, traceDuration(millis() - requestStart));
+    }
+}
+
 void WiFiManager::update()
 {
-    if (wifiAttempting)
+    STALL_SCOPE(STALL_WIFI);
+
+    // The new image is only booted once nobody is relying on the beat
+    if (otaPending && !metronome.isRunning() && !metronome.isLiveGigMode())
+    {
+        DEBUG_PRINTLN("Rebooting into new firmware");
+        delay(100);
+        ESP.restart();
+    }
+
+    switch (state)
     {
+    case WIFI_CONNECTING:
         if (WiFi.status() == WL_CONNECTED)
         {
-            wifiConnected = true;
-            wifiAttempting = false;
-            DEBUG_PRINTLN("\nWiFi Connected!");
-            DEBUG_PRINTF("IP address: %s\n", WiFi.localIP().toString().c_str());
+            onConnected();
+        }
+        else if (millis() - wifiStartAttemptTime >
+                 (fastPathAttempt ? WIFI_FAST_TIMEOUT : WIFI_TIMEOUT))
+        {
+            scheduleRetry();
+        }
+        break;
 
-            server.begin();
-            DEBUG_PRINTLN("Web server started");
+    case WIFI_BACKOFF:
+        if ((long)(millis() - nextAttemptTime) >= 0)
+        {
+            startAttempt();
         }
-        else if (millis() - wifiStartAttemptTime > WIFI_TIMEOUT)
+        break;
+
+    case WIFI_CONNECTED:
+        if (WiFi.status() != WL_CONNECTED)
         {
-            wifiAttempting = false;
+            DEBUG_PRINTLN("WiFi connection lost!");
             wifiConnected = false;
-            WiFi.disconnect(true);
-            DEBUG_PRINTLN("\nWiFi connection timed out. Running in offline mode.");
+            connectionLostTime = millis();
+            startAttempt();
         }
+        else
+        {
+            handleClient();
+        }
+        break;
     }
-    else if (!wifiConnected && (WiFi.status() != WL_CONNECTED))
+}
+
+// Flash erases stall the CPU for tens of ms, so let a beat that is about to
+// fire go out before starting the next write
+void WiFiManager::waitForBeatWindow()
+{
+    unsigned long start = millis();
+    while (metronome.isRunning() && metronome.getTimeToNextBeat() < OTA_BEAT_GUARD &&
+           millis() - start < OTA_BEAT_GUARD)
     {
-        DEBUG_PRINTLN("\nLost WiFi connection. Attempting to reconnect...");
-        WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-        wifiStartAttemptTime = millis();
-        wifiAttempting = true;
+        metronome.poll();
+        yield();
     }
+}
+
+bool WiFiManager::otaAuthorized()
+{
+#ifdef OTA_PASSWORD
+    return server.authenticate(OTA_USERNAME, OTA_PASSWORD);
+#else
+    return false;
+#endif
+}
 
-    if (wifiConnected)
+void WiFiManager::handleOtaUpload()
+{
+    HTTPUpload &upload = server.upload();
+
+    if (upload.status == UPLOAD_FILE_START)
     {
-        if (WiFi.status() != WL_CONNECTED)
+        DEBUG_PRINTF("OTA upload started: %s\n", upload.filename.c_str());
+        otaFailed = false;
+        otaBytes = 0;
+        otaStartTime = millis();
+
+        // The upload arrives before the route handler can answer 401
+        if (!otaAuthorized())
         {
-            DEBUG_PRINTLN("WiFi connection lost!");
-            wifiConnected = false;
+            DEBUG_PRINTLN("OTA: not authorized");
+            otaFailed = true;
+            return;
+        }
+
+        readCapped = false; // An image takes longer than a request to arrive
+
+        uint32_t maxSize = (ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000;
+        if (!server.hasArg("md5") || !Update.begin(maxSize) ||
+            !Update.setMD5(server.arg("md5").c_str()))
+        {
+            DEBUG_PRINTLN("OTA: could not start update");
+            otaFailed = true;
+        }
+    }
+    else if (upload.status == UPLOAD_FILE_WRITE && !otaFailed)
+    {
+        waitForBeatWindow();
+        size_t written = Update.write(upload.buf, upload.currentSize);
+        otaBytes += written;
+        if (written != upload.currentSize)
+        {
+            DEBUG_PRINTLN("OTA: flash write failed");
+            otaFailed = true;
+            Update.end(); // Abandons the partial image
+        }
+    }
+    else if (upload.status == UPLOAD_FILE_END && !otaFailed)
+    {
+        waitForBeatWindow();
+
+        // Checks the MD5 before the new image is marked bootable
+        if (Update.end(true))
+        {
+            unsigned long elapsed = max(millis() - otaStartTime, 1UL);
+            otaThroughput = (uint64_t)otaBytes * 1000 / elapsed;
+            otaPending = true;
+            DEBUG_PRINTF("OTA: %u bytes at %lu B/s, waiting for stop\n", otaBytes, otaThroughput);
         }
         else
         {
-            server.handleClient();
+            DEBUG_PRINTLN("OTA: image verification failed");
+            otaFailed = true;
         }
     }
+    else if (upload.status == UPLOAD_FILE_ABORTED)
+    {
+        DEBUG_PRINTLN("OTA upload aborted");
+        Update.end();
+        otaFailed = true;
+    }
 }
 
 void WiFiManager::setupServerRoutes()
 {
-    // Get all patches
-    server.on("/api/patches", HTTP_GET, [this]()
+    // The whole web UI is one gzipped page embedded in the firmware, see
+    // embed_web_assets.py
+    auto sendIndex = [this]()
+    {
+        server.sendHeader("Content-Encoding", "gzip");
+        server.send_P(200, "text/html", (PGM_P)INDEX_HTML_GZ, INDEX_HTML_GZ_SIZE);
+    };
+    server.on("/", HTTP_GET, sendIndex);
+    server.on("/index.html", HTTP_GET, sendIndex);
+
+    // Firmware update, e.g.
+    // curl -u admin:<OTA_PASSWORD> -F image=@firmware.bin "http://<ip>/update?md5=<md5 of firmware.bin>"
+    server.on("/update", HTTP_POST, [this]()
               {
-        StaticJsonDocument<1024> doc;
-        JsonArray array = doc.to<JsonArray>();
-        
-        for (int i = 0; i < storage.getCurrentNumPatches(); i++) {
-            JsonObject patch = array.createNestedObject();
-            patch["name"] = patches[i].name;
-            patch["tempo"] = patches[i].tempo;
+        if (!otaAuthorized()) {
+            server.requestAuthentication();
+            return;
         }
-        
+        if (otaFailed || !otaPending) {
+            server.send(400, "application/json", "{\"error\":\"Update failed\"}");
+            return;
+        }
+
+        StaticJsonDocument<128> doc;
+        doc["status"] = "pending";
+        doc["bytes"] = otaBytes;
+        doc["throughput"] = otaThroughput;
+
         String response;
         serializeJson(doc, response);
+        server.send(200, "application/json", response); }, [this]()
+              { handleOtaUpload(); });
+
+    server.on("/update", HTTP_GET, [this]()
+              {
+        StaticJsonDocument<128> doc;
+        doc["pending"] = otaPending;
+        doc["bytes"] = otaBytes;
+        doc["throughput"] = otaThroughput;
+
+        String response;
+        serializeJson(doc, response);
+        server.send(200, "application/json", response); });
+
+    // Get all patches
+    server.on("/api/patches", HTTP_GET, [this]()
+              {
+        const PatchSnapshot &table = patchTable.read();
+        String response;
+        patchesToJson(table.patches, table.count, response);
         server.send(200, "application/json", response); });
 
+    // Changes are queued for loop(), which applies them to a copy of the
+    // patch table and swaps it in. They are answered 202 once queued, and
+    // 409 when they don't fit the table as it stands.
+
     // Create new patch
     server.on("/api/patches", HTTP_POST, [this]()
               {
         DEBUG_PRINTLN("POST /api/patches received");
         
         if (server.hasArg("plain")) {
-            StaticJsonDocument<200> doc;
+            StaticJsonDocument<PATCH_REQUEST_JSON_SIZE> doc;
             DeserializationError error = deserializeJson(doc, server.arg("plain"));
             
             if (!error) {
-                int currentCount = storage.getCurrentNumPatches();
-                DEBUG_PRINTF("Current patch count before add: %d\n", currentCount);
-                
-                if (currentCount < MAX_PATCHES) {
-                    const char* newName = doc["name"] | "";
-                    int newTempo = doc["tempo"] | 120;
-                    
-                    DEBUG_PRINTF("Adding new patch: name='%s', tempo=%d at index %d\n", 
-                                newName, newTempo, currentCount);
-                    
-                    strlcpy(patches[currentCount].name, newName, sizeof(patches[currentCount].name));
-                    patches[currentCount].tempo = newTempo;
-                    
-                    storage.savePatchCount(currentCount + 1);
-                    storage.savePatches(patches, MAX_PATCHES);
-                    
-                    DEBUG_PRINTF("New patch count: %d\n", storage.getCurrentNumPatches());
-                    
-                    server.send(200, "application/json", "{\"status\":\"success\"}");
+                ControlCommand command = {CONTROL_ADD_PATCH, 0, {}};
+                if (!patchFromJson(doc, command.patch)) {
+                    server.send(400, "application/json", "{\"error\":\"Tempo must be 40-240\"}");
+                } else if (patchTable.read().count < MAX_PATCHES) {
+                    DEBUG_PRINTF("Adding new patch: name='%s', tempo=%d\n",
+                                command.patch.name, command.patch.tempo);
+                    sendControl(command);
                 } else {
                     DEBUG_PRINTLN("Error: Maximum patches reached");
-                    server.send(400, "application/json", "{\"error\":\"Maximum number of patches reached\"}");
+                    server.send(409, "application/json", "{\"error\":\"Maximum number of patches reached\"}");
                 }
             } else {
                 DEBUG_PRINTLN("Error: Invalid JSON");
                 server.send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
             }
+        } else {
+            server.send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
         } });
 
     // Update patch
     server.on("/api/patches", HTTP_PUT, [this]()
               {
-        StaticJsonDocument<200> doc;
+        StaticJsonDocument<PATCH_REQUEST_JSON_SIZE> doc;
         DeserializationError error = deserializeJson(doc, server.arg("plain"));
         
         if (!error) {
             int index = doc["index"] | -1;
-            JsonObject patchObj = doc["patch"];
             
-            if (index >= 0 && index < MAX_PATCHES) {
-                strlcpy(patches[index].name, patchObj["name"] | "", sizeof(patches[index].name));
-                patches[index].tempo = patchObj["tempo"] | 120;
-                storage.savePatches(patches, MAX_PATCHES);
-                server.send(200, "application/json", "{\"status\":\"success\"}");
+            ControlCommand command = {CONTROL_UPDATE_PATCH, (uint8_t)index, {}};
+            if (!patchFromJson(doc["patch"], command.patch)) {
+                server.send(400, "application/json", "{\"error\":\"Tempo must be 40-240\"}");
+            } else if (index >= 0 && index < patchTable.read().count) {
+                sendControl(command);
             } else {
-                server.send(400, "application/json", "{\"error\":\"Invalid patch index\"}");
+                server.send(409, "application/json", "{\"error\":\"Invalid patch index\"}");
             }
+        } else {
+            server.send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
         } });
 
     // Delete patch
@@ -197,27 +450,15 @@ void WiFiManager::setupServerRoutes()
 
         if (!error) {
             int index = doc["index"] | -1;
-            if (index >= 0 && index < storage.getCurrentNumPatches()) {
-                int numPatches = storage.getCurrentNumPatches();
-                
-                for (int i = index; i < numPatches - 1; i++) {
-                    strncpy(patches[i].name, patches[i + 1].name, sizeof(patches[i].name));
-                    patches[i].tempo = patches[i + 1].tempo;
-                }
-
-                memset(patches[numPatches - 1].name, 0, sizeof(patches[numPatches - 1].name));
-                patches[numPatches - 1].tempo = 120;
-
-                storage.savePatchCount(numPatches - 1);
-                storage.savePatches(patches, MAX_PATCHES);
-
-                DEBUG_PRINTF("Deleted patch at index %d, new patch count: %d\n", 
-                            index, storage.getCurrentNumPatches());
-                
-                server.send(200, "application/json", "{\"status\":\"success\"}");
+            int count = patchTable.read().count;
+            if (index >= 0 && index < count && count > 1) {
+                DEBUG_PRINTF("Deleting patch at index %d\n", index);
+                sendControl({CONTROL_DELETE_PATCH, (uint8_t)index, {}});
             } else {
-                server.send(400, "application/json", "{\"error\":\"Invalid patch index\"}");
+                server.send(409, "application/json", "{\"error\":\"Invalid patch index\"}");
             }
+        } else {
+            server.send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
         } });
 
     // Settings endpoints
@@ -230,15 +471,119 @@ void WiFiManager::setupServerRoutes()
         serializeJson(doc, response);
         server.send(200, "application/json", response); });
 
+#if FEATURE_TRACE
+    // Event trace download, decode with tools/trace_analyze.py
+    server.on("/api/trace", HTTP_GET, [this]()
+              {
+        TraceHeader header;
+        header.magic = TRACE_MAGIC;
+        header.version = TRACE_VERSION;
+        header.eventSize = sizeof(TraceEvent);
+        header.count = trace.getCount();
+        header.now = micros();
+
+        server.setContentLength(sizeof(header) + header.count * sizeof(TraceEvent));
+        server.send(200, "application/octet-stream", "");
+        server.sendContent((const char *)&header, sizeof(header));
+
+        // Oldest first, copied in small batches since the ring may wrap
+        TraceEvent batch[32];
+        uint32_t sent = 0;
+        while (sent < header.count) {
+            uint32_t n = min(header.count - sent, (uint32_t)(sizeof(batch) / sizeof(batch[0])));
+            for (uint32_t i = 0; i < n; i++) {
+                batch[i] = trace.getEvent(sent + i);
+            }
+            server.sendContent((const char *)batch, n * sizeof(TraceEvent));
+            sent += n;
+        } });
+#endif
+
+    // Connection metrics
+    server.on("/api/wifi", HTTP_GET, [this]()
+              {
+        StaticJsonDocument<256> doc;
+        doc["channel"] = cachedChannel;
+        doc["rssi"] = WiFi.RSSI();
+        doc["attempts"] = attemptCount;
+        doc["reconnects"] = reconnectCount;
+        doc["lastReconnectMs"] = lastReconnectTime;
+        doc["worstReconnectMs"] = worstReconnectTime;
+
+        String response;
+        serializeJson(doc, response);
+        server.send(200, "application/json", response); });
+
+    // Flash write metrics
+    server.on("/api/storage", HTTP_GET, [this]()
+              {
+        StaticJsonDocument<128> doc;
+        doc["commits"] = storage.getCommitCount();
+        doc["elidedWrites"] = storage.getElidedWrites();
+
+        String response;
+        serializeJson(doc, response);
+        server.send(200, "application/json", response); });
+
+    // Loop stalls, blamed by subsystem, the longest of them across resets
+    server.on("/api/stalls", HTTP_GET, [this]()
+              {
+        StallRecord worst[STALL_REPORT_COUNT];
+        int count = stallWatch.getWorst(worst, STALL_REPORT_COUNT);
+
+        StaticJsonDocument<STALLS_JSON_SIZE> doc;
+        doc["budgetUs"] = STALL_BUDGET_US;
+        doc["stalls"] = stallWatch.getStallCount();
+        JsonObject subsystems = doc.createNestedObject("subsystems");
+        for (int i = 0; i < STALL_SUBSYSTEM_COUNT; i++) {
+            const StallStats &stats = stallWatch.getStats(i);
+            if (stats.count) {
+                JsonObject entry = subsystems.createNestedObject(stallWatch.getName(i));
+                entry["count"] = stats.count;
+                entry["worstUs"] = stats.worst;
+                entry["pc"] = stats.worstPc;
+            }
+        }
+        JsonArray longest = doc.createNestedArray("worst");
+        for (int i = 0; i < count; i++) {
+            JsonObject entry = longest.createNestedObject();
+            entry["subsystem"] = stallWatch.getName(worst[i].subsystem);
+            entry["us"] = worst[i].length;
+            entry["pc"] = worst[i].pc;
+            entry["bootsAgo"] = (uint8_t)(stallWatch.getBoot() - worst[i].boot);
+            entry["ended"] = (worst[i].flags & STALL_FLAG_ENDED) != 0;
+        }
+
+        String response;
+        serializeJson(doc, response);
+        server.send(200, "application/json", response); });
+
     server.on("/api/settings", HTTP_POST, [this]()
               {
         StaticJsonDocument<200> doc;
         DeserializationError error = deserializeJson(doc, server.arg("plain"));
         
         if (!error) {
-            settings.brightness = doc["brightness"] | 1;
-            display.setBrightness(settings.brightness);
-            storage.saveSettings(settings);
-            server.send(200, "application/json", "{\"status\":\"success\"}");
+            int brightness = doc["brightness"] | 1;
+            if (brightness < 0 || brightness > MAX_BRIGHTNESS) {
+                server.send(400, "application/json", "{\"error\":\"Brightness must be 0-15\"}");
+            } else {
+                sendControl({CONTROL_SET_BRIGHTNESS, (uint8_t)brightness, {}});
+            }
+        } else {
+            server.send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
         } });
-}
\ No newline at end of file
+}
+
+void WiFiManager::sendControl(const ControlCommand &command)
+{
+    if (controlQueue.push(command))
+    {
+        server.send(202, "application/json", "{\"status\":\"queued\"}");
+    }
+    else
+    {
+        server.send(503, "application/json", "{\"error\":\"Busy, try again\"}");
+    }
+}
+#endif
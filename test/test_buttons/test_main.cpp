@@ -0,0 +1,231 @@
+// Footswitch debouncing and the gesture table, fed through the realtime
+// core's edge queue and the poll the way loop() runs them
+
+#include <Arduino.h>
+#include <unity.h>
+#include "config.h"
+#include "buttons.h"
+#include "realtime.h"
+#include <vector>
+
+static bool bounceArmed = false;
+
+void setUp()
+{
+    sim::onMillis = nullptr;
+    sim::setPin(LEFT_SWITCH_PIN, HIGH);
+    sim::setPin(RIGHT_SWITCH_PIN, HIGH);
+    realtimeCore.begin();
+    EdgeEvent edge;
+    while (realtimeCore.popEdge(edge))
+    {
+    }
+    sim::advanceMicros(1000000);
+}
+
+void tearDown()
+{
+    sim::onMillis = nullptr;
+}
+
+// loop() passes of 1 ms, counting the gestures of each type
+static void run(Buttons &buttons, unsigned long ms, int counts[])
+{
+    for (unsigned long i = 0; i < ms; i++)
+    {
+        sim::advanceMicros(1000);
+        Gesture gesture;
+        buttons.update();
+        while (buttons.nextGesture(gesture))
+        {
+            counts[gesture.type]++;
+        }
+    }
+}
+
+static void test_bounce_is_one_press_and_one_click()
+{
+    Buttons buttons;
+    buttons.begin();
+    int counts[8] = {0};
+
+    const int bounce[] = {LOW, HIGH, LOW, HIGH, LOW};
+    for (int level : bounce)
+    {
+        sim::setPin(RIGHT_SWITCH_PIN, level);
+        run(buttons, 2, counts);
+    }
+    run(buttons, 200, counts);
+    sim::setPin(RIGHT_SWITCH_PIN, HIGH);
+    sim::setPin(RIGHT_SWITCH_PIN, LOW);
+    sim::setPin(RIGHT_SWITCH_PIN, HIGH);
+    run(buttons, 200, counts);
+
+    TEST_ASSERT_EQUAL_INT(1, counts[GESTURE_PRESS]);
+    TEST_ASSERT_EQUAL_INT(1, counts[GESTURE_CLICK]);
+}
+
+// The switch bounces just after update() emptied the edge queue, and the
+// poll catches the press first, in the next millisecond. The queued bounce
+// then carries a time before the lockout started.
+static void bounceBeforePoll()
+{
+    if (!bounceArmed)
+    {
+        return;
+    }
+    bounceArmed = false;
+    sim::setPin(RIGHT_SWITCH_PIN, LOW);
+    sim::setPin(RIGHT_SWITCH_PIN, HIGH);
+    sim::setPin(RIGHT_SWITCH_PIN, LOW);
+    sim::advanceMicros(1000);
+}
+
+static void test_edge_before_lockout_is_ignored()
+{
+    Buttons buttons;
+    buttons.begin();
+    int counts[8] = {0};
+
+    sim::onMillis = bounceBeforePoll;
+    bounceArmed = true;
+    run(buttons, 100, counts);
+
+    TEST_ASSERT_EQUAL_INT(1, counts[GESTURE_PRESS]);
+    TEST_ASSERT_EQUAL_INT(0, counts[GESTURE_CLICK]);
+}
+
+struct Seen
+{
+    GestureType type;
+    ButtonId button;
+    unsigned long at; // millis() when update() reported it
+};
+
+// loop() passes of 1 ms, keeping every gesture in order
+static void record(Buttons &buttons, unsigned long ms, std::vector<Seen> &seen)
+{
+    for (unsigned long i = 0; i < ms; i++)
+    {
+        sim::advanceMicros(1000);
+        Gesture gesture;
+        buttons.update();
+        while (buttons.nextGesture(gesture))
+        {
+            seen.push_back({gesture.type, gesture.button, millis()});
+        }
+    }
+}
+
+static int countOf(const std::vector<Seen> &seen, GestureType type)
+{
+    int count = 0;
+    for (const Seen &gesture : seen)
+    {
+        count += gesture.type == type;
+    }
+    return count;
+}
+
+// Down for `down` ms, then up for `up` ms
+static void tap(Buttons &buttons, uint8_t pin, unsigned long down, unsigned long up, std::vector<Seen> &seen)
+{
+    sim::setPin(pin, LOW);
+    record(buttons, down, seen);
+    sim::setPin(pin, HIGH);
+    record(buttons, up, seen);
+}
+
+// A second press inside DOUBLE_TAP_TIME is a DOUBLE at its leading edge and
+// doesn't click as well, one outside it is a plain press again
+static void test_double_press()
+{
+    Buttons buttons;
+    buttons.begin();
+    std::vector<Seen> seen;
+
+    tap(buttons, RIGHT_SWITCH_PIN, 80, 120, seen);
+    tap(buttons, RIGHT_SWITCH_PIN, 80, 400, seen);
+    TEST_ASSERT_EQUAL_INT(4, seen.size());
+    TEST_ASSERT_EQUAL(GESTURE_PRESS, seen[0].type);
+    TEST_ASSERT_EQUAL(GESTURE_CLICK, seen[1].type);
+    TEST_ASSERT_EQUAL(GESTURE_PRESS, seen[2].type);
+    TEST_ASSERT_EQUAL(GESTURE_DOUBLE, seen[3].type);
+    TEST_ASSERT_EQUAL_UINT32(seen[2].at, seen[3].at);
+
+    seen.clear();
+    tap(buttons, RIGHT_SWITCH_PIN, 80, 400, seen);
+    TEST_ASSERT_EQUAL_INT(0, countOf(seen, GESTURE_DOUBLE));
+    TEST_ASSERT_EQUAL_INT(1, countOf(seen, GESTURE_CLICK));
+}
+
+// Both switches down inside CHORD_TIME make one CHORD on the second press,
+// and neither press clicks or holds. Further apart they're two presses.
+static void test_chord()
+{
+    Buttons buttons;
+    buttons.begin();
+    std::vector<Seen> seen;
+
+    sim::setPin(LEFT_SWITCH_PIN, LOW);
+    record(buttons, 40, seen);
+    sim::setPin(RIGHT_SWITCH_PIN, LOW);
+    record(buttons, HOLD_THRESHOLD + 100, seen);
+    sim::setPin(LEFT_SWITCH_PIN, HIGH);
+    sim::setPin(RIGHT_SWITCH_PIN, HIGH);
+    record(buttons, 400, seen);
+
+    TEST_ASSERT_EQUAL_INT(3, seen.size());
+    TEST_ASSERT_EQUAL(GESTURE_PRESS, seen[0].type);
+    TEST_ASSERT_EQUAL(GESTURE_PRESS, seen[1].type);
+    TEST_ASSERT_EQUAL(GESTURE_CHORD, seen[2].type);
+    TEST_ASSERT_EQUAL(BUTTON_RIGHT, seen[2].button);
+    TEST_ASSERT_EQUAL_UINT32(seen[1].at, seen[2].at);
+
+    seen.clear();
+    sim::setPin(LEFT_SWITCH_PIN, LOW);
+    record(buttons, CHORD_TIME + 50, seen);
+    sim::setPin(RIGHT_SWITCH_PIN, LOW);
+    record(buttons, 100, seen);
+    sim::setPin(LEFT_SWITCH_PIN, HIGH);
+    sim::setPin(RIGHT_SWITCH_PIN, HIGH);
+    record(buttons, 400, seen);
+    TEST_ASSERT_EQUAL_INT(0, countOf(seen, GESTURE_CHORD));
+    TEST_ASSERT_EQUAL_INT(2, countOf(seen, GESTURE_CLICK));
+}
+
+// Held, LONG comes at HOLD_THRESHOLD and a REPEAT every HOLD_REPEAT_TIME
+// after it, and letting go doesn't click
+static void test_hold_repeats()
+{
+    Buttons buttons;
+    buttons.begin();
+    std::vector<Seen> seen;
+
+    sim::setPin(RIGHT_SWITCH_PIN, LOW);
+    unsigned long pressed = millis(); // The edge interrupt stamps it now
+    record(buttons, HOLD_THRESHOLD + 3 * HOLD_REPEAT_TIME + 100, seen);
+    sim::setPin(RIGHT_SWITCH_PIN, HIGH);
+    record(buttons, 200, seen);
+
+    TEST_ASSERT_EQUAL_INT(5, seen.size());
+    TEST_ASSERT_EQUAL(GESTURE_PRESS, seen[0].type);
+    TEST_ASSERT_EQUAL(GESTURE_LONG, seen[1].type);
+    TEST_ASSERT_EQUAL_UINT32(pressed + HOLD_THRESHOLD, seen[1].at);
+    for (int i = 2; i < 5; i++)
+    {
+        TEST_ASSERT_EQUAL(GESTURE_REPEAT, seen[i].type);
+        TEST_ASSERT_EQUAL_UINT32(HOLD_REPEAT_TIME, seen[i].at - seen[i - 1].at);
+    }
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_bounce_is_one_press_and_one_click);
+    RUN_TEST(test_edge_before_lockout_is_ignored);
+    RUN_TEST(test_double_press);
+    RUN_TEST(test_chord);
+    RUN_TEST(test_hold_repeats);
+    return UNITY_END();
+}
@@ -0,0 +1,185 @@
+// Web interface changes on their way to loop(): the control queue and the
+// patch table on real threads, and the commands applied to a table
+
+#include <Arduino.h>
+#include <unity.h>
+#include <atomic>
+#include <thread>
+#include "config.h"
+#include "control.h"
+#include "patch_table.h"
+
+void setUp() {}
+
+void tearDown() {}
+
+// Every command must arrive, in order
+static void test_queue_keeps_order_across_threads()
+{
+    const uint32_t commands = 200000;
+    ControlQueue queue;
+    unsigned long outOfOrder = 0;
+
+    std::thread producer([&]
+                         {
+        for (uint32_t i = 0; i < commands; i++) {
+            ControlCommand command = {CONTROL_UPDATE_PATCH, uint8_t(i), {}};
+            command.patch.tempo = i;
+            while (!queue.push(command)) {
+                std::this_thread::yield();
+            }
+        } });
+
+    for (uint32_t expected = 0; expected < commands;)
+    {
+        const ControlCommand *command = queue.peek();
+        if (!command)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        outOfOrder += (uint32_t)command->patch.tempo != expected || command->value != uint8_t(expected);
+        queue.pop();
+        expected++;
+    }
+    producer.join();
+
+    TEST_ASSERT_EQUAL_UINT32(0, outOfOrder);
+    TEST_ASSERT_NULL(queue.peek());
+}
+
+// Every publish fills the table with one version, so a torn read shows up as
+// mixed versions or a count that doesn't match them
+static void test_snapshots_are_never_torn()
+{
+    const int publishes = 20000;
+    PatchTable table;
+    std::atomic<bool> done(false);
+    unsigned long reads = 0;
+    unsigned long torn = 0;
+
+    std::thread reader([&]
+                       {
+        while (!done.load()) {
+            const PatchSnapshot &snapshot = table.read();
+            int version = snapshot.patches[0].tempo;
+            bool consistent = snapshot.count == 1 + version % MAX_PATCHES;
+            for (int i = 0; i < MAX_PATCHES; i++) {
+                consistent = consistent && snapshot.patches[i].tempo == version;
+            }
+            torn += !consistent;
+            reads++;
+            std::this_thread::yield(); // Like the gap between loop() passes
+        } });
+
+    for (int version = 1; version <= publishes; version++)
+    {
+        PatchSnapshot *edit;
+        while (!(edit = table.beginEdit()))
+        {
+            std::this_thread::yield();
+        }
+        for (int i = 0; i < MAX_PATCHES; i++)
+        {
+            edit->patches[i].tempo = version;
+        }
+        edit->count = 1 + version % MAX_PATCHES;
+        table.publish();
+    }
+    done.store(true);
+    reader.join();
+
+    TEST_ASSERT_GREATER_THAN(0, reads);
+    TEST_ASSERT_EQUAL_UINT32(0, torn);
+}
+
+// The writer waits for the reader to move off the spare copy
+static void test_edit_waits_for_reader()
+{
+    PatchTable table;
+    table.read();
+    TEST_ASSERT_NOT_NULL(table.beginEdit());
+    table.publish();
+    TEST_ASSERT_NULL(table.beginEdit());
+    table.read();
+    TEST_ASSERT_NOT_NULL(table.beginEdit());
+}
+
+static PatchSnapshot tableOf(int count)
+{
+    PatchSnapshot table = {};
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(table.patches[i].name, sizeof(table.patches[i].name), "P%d", i);
+        table.patches[i].tempo = 100 + i;
+    }
+    table.count = count;
+    return table;
+}
+
+// Indexes are checked against the table the command lands on, an earlier
+// command may have moved things since the web handler checked them. A tempo
+// storage can't hold is refused as well.
+static void test_commands_that_no_longer_apply()
+{
+    PatchSnapshot table = tableOf(2);
+    ControlCommand remove = {CONTROL_DELETE_PATCH, 1, {}};
+    TEST_ASSERT_TRUE(applyPatchCommand(remove, table));
+    TEST_ASSERT_EQUAL_INT(1, table.count);
+
+    ControlCommand update = {CONTROL_UPDATE_PATCH, 1, {"NEW", 90, {}}};
+    TEST_ASSERT_FALSE(applyPatchCommand(update, table));
+    TEST_ASSERT_FALSE(applyPatchCommand({CONTROL_DELETE_PATCH, 0, {}}, table));
+    TEST_ASSERT_EQUAL_INT(1, table.count);
+
+    ControlCommand tooFast = {CONTROL_UPDATE_PATCH, 0, {"FAST", 300, {}}};
+    TEST_ASSERT_FALSE(applyPatchCommand(tooFast, table));
+    TEST_ASSERT_EQUAL_INT(100, table.patches[0].tempo);
+
+    PatchSnapshot full = tableOf(MAX_PATCHES);
+    TEST_ASSERT_FALSE(applyPatchCommand({CONTROL_ADD_PATCH, 0, {"NEW", 90, {}}}, full));
+    TEST_ASSERT_EQUAL_INT(MAX_PATCHES, full.count);
+}
+
+static void test_delete_closes_the_gap()
+{
+    PatchSnapshot table = tableOf(3);
+    TEST_ASSERT_TRUE(applyPatchCommand({CONTROL_DELETE_PATCH, 0, {}}, table));
+    TEST_ASSERT_EQUAL_INT(2, table.count);
+    TEST_ASSERT_EQUAL_STRING("P1", table.patches[0].name);
+    TEST_ASSERT_EQUAL_STRING("P2", table.patches[1].name);
+    TEST_ASSERT_EQUAL_STRING("", table.patches[2].name);
+}
+
+// Renaming the playing patch mustn't restart its ramp, changing its tempo
+// or curve must
+static void test_only_tempo_edits_change_tempo()
+{
+    Patch before = {"SLOW", 90, {CURVE_LINEAR, 0, 32, 140}};
+    Patch after = before;
+    strcpy(after.name, "WARM");
+    TEST_ASSERT_FALSE(changesTempo(before, after));
+
+    after.tempo = 91;
+    TEST_ASSERT_TRUE(changesTempo(before, after));
+
+    after = before;
+    after.curve.endTempo = 150;
+    TEST_ASSERT_TRUE(changesTempo(before, after));
+
+    after = before;
+    after.curve.type = CURVE_NONE;
+    TEST_ASSERT_TRUE(changesTempo(before, after));
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_queue_keeps_order_across_threads);
+    RUN_TEST(test_snapshots_are_never_torn);
+    RUN_TEST(test_edit_waits_for_reader);
+    RUN_TEST(test_commands_that_no_longer_apply);
+    RUN_TEST(test_delete_closes_the_gap);
+    RUN_TEST(test_only_tempo_edits_change_tempo);
+    return UNITY_END();
+}
@@ -0,0 +1,76 @@
+// What the display puts on the bus for each view, read back from the rows
+// the HT16K33 stand-in last sent
+
+#include <Arduino.h>
+#include <unity.h>
+#include "config.h"
+#include "display.h"
+#include "metronome.h"
+#include "realtime.h"
+
+static Patch patches[MAX_PATCHES];
+
+void setUp()
+{
+    realtimeCore.begin();
+    memset(patches, 0, sizeof(patches));
+    patches[0] = {"SLOW", 90, {CURVE_LINEAR, 0, 2, 140}};
+}
+
+void tearDown() {}
+
+// The four characters shown, decimal points left out
+static const char *shownText()
+{
+    static char text[5];
+    for (int i = 0; i < 4; i++)
+    {
+        text[i] = Adafruit_AlphaNum4::shown[i] & 0xFF;
+    }
+    return text;
+}
+
+// A ramp moves the tempo away from the patch's, the display follows it
+static void test_patch_view_shows_the_playing_tempo()
+{
+    Display display;
+    display.begin();
+    Metronome metronome;
+    metronome.begin();
+    metronome.setTempo(patches[0].tempo, TEMPO_NOW, &patches[0].curve);
+    metronome.start();
+
+    while (metronome.getBeatCount() < BEATS_PER_BAR + 1)
+    {
+        sim::advanceMicros(1000);
+        metronome.update(true);
+    }
+    TEST_ASSERT_NOT_EQUAL(patches[0].tempo, metronome.getTempo());
+
+    display.update(PATCH_MODE, 0, patches, metronome.getTempo(), false, false, false);
+    String expected = String(metronome.getTempo());
+    while (expected.length() < 4)
+    {
+        expected = " " + expected;
+    }
+    TEST_ASSERT_EQUAL_STRING(expected.c_str(), shownText());
+}
+
+static void test_patch_view_shows_the_name()
+{
+    Display display;
+    display.begin();
+    display.update(PATCH_MODE, 0, patches, 117, true, true, true);
+
+    TEST_ASSERT_EQUAL_STRING("SLOW", shownText());
+    TEST_ASSERT_TRUE(Adafruit_AlphaNum4::shown[0] & DISPLAY_DECIMAL_BIT);
+    TEST_ASSERT_TRUE(Adafruit_AlphaNum4::shown[3] & DISPLAY_DECIMAL_BIT);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_patch_view_shows_the_playing_tempo);
+    RUN_TEST(test_patch_view_shows_the_name);
+    return UNITY_END();
+}
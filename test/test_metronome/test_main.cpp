@@ -0,0 +1,248 @@
+// Beat scheduling: tempo changes in each TempoChange mode land with exact
+// intervals, a patch's curve starts on the beat after the press, and a tapped
+// tempo isn't overridden by a change still waiting, a late beat stays on its
+// grid, and the trace times each beat at the LED pulse
+
+#include <Arduino.h>
+#include <unity.h>
+#include "config.h"
+#include "metronome.h"
+#include "realtime.h"
+#include "tempo_curve.h"
+#include "trace.h"
+
+void setUp()
+{
+    realtimeCore.begin();
+}
+
+void tearDown() {}
+
+// Beat times around a 120 to 150 BPM change made `offset` us into beat
+// `changeBeat`. Returns how many of the 15 intervals aren't what was asked for.
+static int checkTempoChange(TempoChange when, unsigned long offset, uint32_t changeBeat)
+{
+    const unsigned long oldInterval = 60000000UL / 120;
+    const unsigned long newInterval = 60000000UL / 150;
+
+    Metronome metronome;
+    metronome.begin();
+    metronome.setTempo(120);
+    metronome.start();
+
+    unsigned long beats[16];
+    uint32_t count = 0;
+    bool changed = false;
+
+    while (count < 16)
+    {
+        sim::advanceMicros(100);
+        metronome.update(true);
+
+        if (metronome.getBeatCount() != count)
+        {
+            beats[count++] = metronome.getLastBeat();
+        }
+        // getLastBeat() moves with a TEMPO_NOW change, so it's read first
+        if (!changed && count == changeBeat && micros() - beats[count - 1] >= offset)
+        {
+            metronome.setTempo(150, when);
+            changed = true;
+        }
+    }
+    metronome.stop();
+
+    int mismatches = 0;
+    unsigned long changeTime = beats[changeBeat - 1] + offset;
+    for (uint32_t i = 1; i < 16; i++)
+    {
+        // Interval i runs from beat i - 1, the first beat out is a downbeat
+        uint32_t from = i - 1;
+        unsigned long expected = oldInterval;
+        if (when == TEMPO_NOW)
+        {
+            if (from == changeBeat - 1)
+            {
+                unsigned long elapsed = changeTime - beats[from];
+                expected = elapsed + (uint64_t)(oldInterval - elapsed) * newInterval / oldInterval;
+            }
+            else if (from >= changeBeat)
+            {
+                expected = newInterval;
+            }
+        }
+        else if (when == TEMPO_NEXT_BEAT)
+        {
+            expected = from >= changeBeat ? newInterval : oldInterval;
+        }
+        else
+        {
+            uint32_t downbeat = (changeBeat + BEATS_PER_BAR - 1) / BEATS_PER_BAR * BEATS_PER_BAR;
+            expected = from >= downbeat ? newInterval : oldInterval;
+        }
+        mismatches += beats[i] - beats[i - 1] != expected;
+    }
+    return mismatches;
+}
+
+// Changes at a spread of points in the first six beats
+static int checkTempoChanges(TempoChange when)
+{
+    int mismatches = 0;
+    for (uint32_t changeBeat = 1; changeBeat <= 6; changeBeat++)
+    {
+        for (unsigned long offset = 1000; offset < 500000; offset += 123000)
+        {
+            mismatches += checkTempoChange(when, offset, changeBeat);
+        }
+    }
+    return mismatches;
+}
+
+static void test_change_now_keeps_phase()
+{
+    TEST_ASSERT_EQUAL_INT(0, checkTempoChanges(TEMPO_NOW));
+}
+
+static void test_change_on_next_beat()
+{
+    TEST_ASSERT_EQUAL_INT(0, checkTempoChanges(TEMPO_NEXT_BEAT));
+}
+
+static void test_change_on_next_bar()
+{
+    TEST_ASSERT_EQUAL_INT(0, checkTempoChanges(TEMPO_NEXT_BAR));
+}
+
+// Runs the metronome until its next beat has gone out
+static void runToNextBeat(Metronome &metronome)
+{
+    uint32_t beatCount = metronome.getBeatCount();
+    while (metronome.getBeatCount() == beatCount)
+    {
+        sim::advanceMicros(100);
+        metronome.update(true);
+    }
+}
+
+// A patch picked partway through a beat starts on the next one, with the
+// first interval of its curve
+static void test_patch_change_starts_on_next_beat()
+{
+    const TempoCurve curve = {CURVE_LINEAR, 0, 8, 180};
+    Metronome metronome;
+    metronome.begin();
+    metronome.setTempo(120);
+    metronome.start();
+
+    for (unsigned long offset = 1000; offset < 500000; offset += 61000)
+    {
+        runToNextBeat(metronome);
+        sim::advanceMicros(offset);
+        metronome.update(true);
+        unsigned long nextBeat = metronome.getNextBeat();
+        unsigned long effect = metronome.setTempo(100, PATCH_TEMPO_CHANGE, &curve);
+        TEST_ASSERT_EQUAL_UINT32(nextBeat, effect);
+
+        runToNextBeat(metronome);
+        TempoRamp expected;
+        expected.start(100, curve);
+        TEST_ASSERT_EQUAL_UINT32(effect, metronome.getLastBeat());
+        TEST_ASSERT_EQUAL_INT(100, metronome.getTempo());
+        TEST_ASSERT_EQUAL_UINT32(expected.nextInterval(), metronome.getNextBeat() - effect);
+
+        metronome.setTempo(120);
+    }
+}
+
+// A change still waiting for its beat when the player taps must not replace
+// the tapped tempo on that beat
+static void test_tap_replaces_pending_change()
+{
+    Metronome metronome;
+    metronome.begin();
+    metronome.setTempo(120);
+    metronome.start();
+    runToNextBeat(metronome);
+
+    metronome.setTempo(150, TEMPO_NEXT_BAR);
+    metronome.tap(millis());
+    sim::advanceMicros(600000);
+    metronome.tap(millis());
+    TEST_ASSERT_EQUAL_INT(100, metronome.getTempo());
+
+    for (int i = 0; i < 2 * BEATS_PER_BAR; i++)
+    {
+        runToNextBeat(metronome);
+    }
+    TEST_ASSERT_EQUAL_INT(100, metronome.getTempo());
+}
+
+// A beat loop() gets to late stays on the grid, unless it is late by the
+// whole interval it was scheduled with
+static void test_late_beat_keeps_its_grid()
+{
+    Metronome metronome;
+    metronome.begin();
+    metronome.setTempo(120);
+    metronome.start();
+    runToNextBeat(metronome);
+
+    unsigned long beatTime = metronome.getNextBeat();
+    sim::advanceMicros(beatTime - micros() + 499000);
+    metronome.update(true);
+    TEST_ASSERT_EQUAL_UINT32(beatTime, metronome.getLastBeat());
+    TEST_ASSERT_EQUAL_UINT32(beatTime + 500000, metronome.getNextBeat());
+
+    beatTime = metronome.getNextBeat();
+    sim::advanceMicros(beatTime - micros() + 500000);
+    metronome.update(true);
+    TEST_ASSERT_EQUAL_UINT32(micros(), metronome.getLastBeat());
+    TEST_ASSERT_EQUAL_UINT32(micros() + 500000, metronome.getNextBeat());
+    metronome.stop();
+}
+
+// loop() stalls for 30 ms across every other beat. The timer still fires
+// the LED on time, and that's the time and the lateness the trace keeps.
+static void test_beat_is_traced_at_the_led()
+{
+    Metronome metronome;
+    metronome.begin();
+    metronome.setTempo(120);
+    metronome.start();
+
+    for (int beat = 0; beat < 8; beat++)
+    {
+        runToNextBeat(metronome);
+        unsigned long ledTime = metronome.getNextBeat() - OUTPUT_OFFSET_LED;
+        if (beat % 2)
+        {
+            while ((long)(micros() - (ledTime - 10000)) < 0)
+            {
+                sim::advanceMicros(100);
+                metronome.update(true);
+            }
+            sim::advanceMicros(30000);
+        }
+        runToNextBeat(metronome);
+
+        const TraceEvent &event = trace.getEvent(trace.getCount() - 1);
+        TEST_ASSERT_EQUAL_UINT8(TRACE_BEAT, event.type);
+        TEST_ASSERT_UINT32_WITHIN(1, ledTime, event.timestamp);
+        TEST_ASSERT_LESS_OR_EQUAL_UINT32(1, event.b);
+    }
+    metronome.stop();
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_change_now_keeps_phase);
+    RUN_TEST(test_change_on_next_beat);
+    RUN_TEST(test_change_on_next_bar);
+    RUN_TEST(test_patch_change_starts_on_next_beat);
+    RUN_TEST(test_tap_replaces_pending_change);
+    RUN_TEST(test_late_beat_keeps_its_grid);
+    RUN_TEST(test_beat_is_traced_at_the_led);
+    return UNITY_END();
+}
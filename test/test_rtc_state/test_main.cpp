@@ -0,0 +1,206 @@
+// RTC checkpoint: what a warm reset hands back, what it must refuse, and a
+// metronome picking its beat up from it
+
+#include <Arduino.h>
+#include <unity.h>
+#include "config.h"
+#include "metronome.h"
+#include "realtime.h"
+#include "rtc_state.h"
+
+// Power-on leaves RTC memory holding noise
+void setUp()
+{
+    for (size_t i = 0; i < 128; i++)
+    {
+        sim::rtcUserMemory[i] = 0xA5A5A5A5 ^ (i * 2654435761u);
+    }
+    sim::resetReason = REASON_DEFAULT_RST;
+}
+
+void tearDown() {}
+
+// The RTC timer ticks every 6.7 us, the elapsed time comes back within a
+// couple of ticks
+#define RTC_TOLERANCE_US 15
+
+static BeatState beatAt(int tempo, uint32_t beatCount)
+{
+    BeatState beat;
+    memset((void *)&beat, 0, sizeof(beat));
+    beat.tempo = tempo;
+    beat.running = true;
+    beat.beatCount = beatCount;
+    beat.interval = 60000000UL / tempo;
+    return beat;
+}
+
+// A session that checkpoints a running beat at 132 BPM
+static void runSession(uint32_t beatCount, unsigned long lastBeat)
+{
+    RtcState state;
+    TEST_ASSERT_FALSE(state.begin());
+    state.update(FREE_MODE, 3, beatAt(132, beatCount), lastBeat);
+}
+
+static void test_checkpoint_round_trip()
+{
+    sim::advanceMicros(1000000);
+    runSession(7, micros());
+    sim::advanceMicros(250000);
+
+    sim::resetReason = REASON_WDT_RST;
+    RtcState resumed;
+    TEST_ASSERT_TRUE(resumed.begin());
+    TEST_ASSERT_EQUAL(FREE_MODE, resumed.getMode());
+    TEST_ASSERT_EQUAL_INT(3, resumed.getPatch());
+    TEST_ASSERT_EQUAL_INT(132, resumed.getTempo());
+    TEST_ASSERT_TRUE(resumed.wasRunning());
+    TEST_ASSERT_EQUAL_UINT32(7, resumed.getBeatState().beatCount);
+    TEST_ASSERT_UINT32_WITHIN(RTC_TOLERANCE_US, 250000, resumed.getTimeSinceLastBeat());
+}
+
+static void test_power_on_noise_is_rejected()
+{
+    RtcState state;
+    TEST_ASSERT_FALSE(state.begin());
+}
+
+static void test_damaged_checkpoint_is_rejected()
+{
+    runSession(1, micros());
+    sim::rtcUserMemory[RTC_STATE_OFFSET + 2] ^= 0x10;
+
+    sim::resetReason = REASON_EXCEPTION_RST;
+    RtcState state;
+    TEST_ASSERT_FALSE(state.begin());
+}
+
+static void test_deep_sleep_wake_starts_fresh()
+{
+    runSession(1, micros());
+
+    sim::resetReason = REASON_DEEP_SLEEP_AWAKE;
+    RtcState state;
+    TEST_ASSERT_FALSE(state.begin());
+}
+
+static void test_cleared_checkpoint_is_rejected()
+{
+    runSession(1, micros());
+    RtcState().clear();
+
+    sim::resetReason = REASON_SOFT_WDT_RST;
+    RtcState state;
+    TEST_ASSERT_FALSE(state.begin());
+}
+
+// loop() gets to the checkpoint a while after the beat went out
+static void test_beat_time_is_the_beats_own()
+{
+    sim::advanceMicros(1000000);
+    unsigned long beat = micros();
+    sim::advanceMicros(40000);
+    runSession(1, beat);
+    sim::advanceMicros(100000);
+
+    sim::resetReason = REASON_WDT_RST;
+    RtcState state;
+    TEST_ASSERT_TRUE(state.begin());
+    TEST_ASSERT_UINT32_WITHIN(RTC_TOLERANCE_US, 140000, state.getTimeSinceLastBeat());
+}
+
+// setTempo(TEMPO_NOW) stretches the beat and moves lastBeat to match the
+// new interval without a beat going out
+static void test_stretched_beat_keeps_its_grid()
+{
+    RtcState state;
+    TEST_ASSERT_FALSE(state.begin());
+    sim::advanceMicros(1000000);
+    state.update(PATCH_MODE, 0, beatAt(120, 1), micros());
+    sim::advanceMicros(200000);
+    state.update(PATCH_MODE, 0, beatAt(150, 1), micros() - 100000);
+    sim::advanceMicros(50000);
+
+    sim::resetReason = REASON_WDT_RST;
+    RtcState resumed;
+    TEST_ASSERT_TRUE(resumed.begin());
+    TEST_ASSERT_EQUAL_INT(150, resumed.getTempo());
+    TEST_ASSERT_UINT32_WITHIN(RTC_TOLERANCE_US, 150000, resumed.getTimeSinceLastBeat());
+}
+
+// A ramping patch is reset partway through its seventh beat and resumed
+// from the checkpoint. The reset sits through beat 7, every beat after it
+// has to land on the grid and bar the ramp would have put it on.
+static void test_resume_keeps_the_grid()
+{
+    const TempoCurve curve = {CURVE_LINEAR, 0, 4, 160};
+    realtimeCore.begin();
+    Metronome metronome;
+    metronome.begin();
+    metronome.setTempo(100, TEMPO_NOW, &curve);
+    metronome.start();
+
+    RtcState state;
+    TEST_ASSERT_FALSE(state.begin());
+    unsigned long firstBeat = 0;
+    while (metronome.getBeatCount() < 6 || micros() - metronome.getLastBeat() < 300000)
+    {
+        sim::advanceMicros(100);
+        metronome.update(true);
+        if (metronome.getBeatCount() == 1 && !firstBeat)
+        {
+            firstBeat = metronome.getLastBeat();
+        }
+        BeatState beat;
+        metronome.getState(beat);
+        state.update(PATCH_MODE, 0, beat, metronome.getLastBeat());
+    }
+
+    // Beat n goes out at grid[n - 1]
+    unsigned long grid[24];
+    TempoRamp expected;
+    expected.start(100, curve);
+    grid[0] = firstBeat;
+    for (int i = 1; i < 24; i++)
+    {
+        grid[i] = grid[i - 1] + expected.nextInterval();
+    }
+
+    sim::advanceMicros(400000);
+    sim::resetReason = REASON_WDT_RST;
+    RtcState restored;
+    TEST_ASSERT_TRUE(restored.begin());
+    Metronome resumed;
+    resumed.begin();
+    resumed.resume(restored.getBeatState(), restored.getTimeSinceLastBeat());
+    TEST_ASSERT_TRUE(resumed.isRunning());
+
+    uint32_t count = resumed.getBeatCount();
+    TEST_ASSERT_EQUAL_UINT32(7, count);
+    while (count < 24)
+    {
+        sim::advanceMicros(100);
+        resumed.update(true);
+        if (resumed.getBeatCount() != count)
+        {
+            count = resumed.getBeatCount();
+            TEST_ASSERT_UINT32_WITHIN(RTC_TOLERANCE_US, grid[count - 1], resumed.getLastBeat());
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(160, resumed.getTempo());
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_checkpoint_round_trip);
+    RUN_TEST(test_power_on_noise_is_rejected);
+    RUN_TEST(test_damaged_checkpoint_is_rejected);
+    RUN_TEST(test_deep_sleep_wake_starts_fresh);
+    RUN_TEST(test_cleared_checkpoint_is_rejected);
+    RUN_TEST(test_beat_time_is_the_beats_own);
+    RUN_TEST(test_stretched_beat_keeps_its_grid);
+    RUN_TEST(test_resume_keeps_the_grid);
+    return UNITY_END();
+}
@@ -0,0 +1,331 @@
+// Serial control frames decoded and handed to the metronome the way loop()
+// does it: tempo changes start on the beat they were acknowledged for, with
+// exact intervals, and damaged frames are refused. The same frames also go
+// through a pseudo-terminal, split up and damaged the way a USB serial link
+// hands them over.
+
+#include <Arduino.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <unity.h>
+#include <vector>
+#include "config.h"
+#include "metronome.h"
+#include "realtime.h"
+#include "serial_control.h"
+
+// Whatever is injected is there on the next read, replies are kept
+class TestSerial : public Stream
+{
+public:
+    int available() override { return rx.size() - position; }
+    int read() override { return rx[position++]; }
+
+    size_t write(const uint8_t *buffer, size_t size) override
+    {
+        tx.insert(tx.end(), buffer, buffer + size);
+        return size;
+    }
+
+    std::vector<uint8_t> rx;
+    size_t position = 0;
+    std::vector<uint8_t> tx;
+};
+
+// A pseudo-terminal in raw mode, as the host tool opens the pedal's port.
+// The pedal reads and writes the slave end, the test plays the host on the
+// master end, so every byte goes through the tty layer.
+class PtySerial : public Stream
+{
+public:
+    PtySerial()
+    {
+        host = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+        grantpt(host);
+        unlockpt(host);
+        pedal = open(ptsname(host), O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+        termios mode;
+        tcgetattr(pedal, &mode);
+        cfmakeraw(&mode);
+        tcsetattr(pedal, TCSANOW, &mode);
+    }
+
+    ~PtySerial()
+    {
+        close(pedal);
+        close(host);
+    }
+
+    bool isOpen() const { return host >= 0 && pedal >= 0; }
+
+    int available() override { return pending(pedal); }
+
+    int read() override
+    {
+        uint8_t byte;
+        return ::read(pedal, &byte, 1) == 1 ? byte : -1;
+    }
+
+    size_t write(const uint8_t *buffer, size_t size) override
+    {
+        ssize_t written = ::write(pedal, buffer, size);
+        return written > 0 ? written : 0;
+    }
+
+    // Sends bytes from the host and waits until the pedal end has them all
+    bool hostWrite(const uint8_t *bytes, size_t size)
+    {
+        int before = pending(pedal);
+        return ::write(host, bytes, size) == (ssize_t)size && waitFor(pedal, before + size);
+    }
+
+    // The next size bytes the pedal sent, empty if they don't come
+    std::vector<uint8_t> hostRead(size_t size)
+    {
+        std::vector<uint8_t> bytes(size);
+        if (!waitFor(host, size) || ::read(host, bytes.data(), size) != (ssize_t)size)
+        {
+            bytes.clear();
+        }
+        return bytes;
+    }
+
+private:
+    int host;
+    int pedal;
+
+    static int pending(int fd)
+    {
+        int count = 0;
+        ioctl(fd, FIONREAD, &count);
+        return count;
+    }
+
+    // The tty moves bytes across on its own time, give it up to a second
+    static bool waitFor(int fd, size_t count)
+    {
+        for (int i = 0; i < 1000; i++)
+        {
+            if ((size_t)pending(fd) >= count)
+            {
+                return true;
+            }
+            usleep(1000);
+        }
+        return false;
+    }
+};
+
+void setUp()
+{
+    realtimeCore.begin();
+}
+
+void tearDown() {}
+
+// Encodes a host-to-pedal frame as tools/serial_control.py does
+static std::vector<uint8_t> encodeFrame(SerialFrameType type, const std::vector<uint8_t> &payload)
+{
+    std::vector<uint8_t> frame = {SERIAL_SYNC, type, (uint8_t)payload.size()};
+    frame.insert(frame.end(), payload.begin(), payload.end());
+
+    uint8_t crc = 0;
+    for (size_t i = 1; i < frame.size(); i++)
+    {
+        crc ^= frame[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    frame.push_back(crc);
+    return frame;
+}
+
+static void sendFrame(TestSerial &port, SerialFrameType type, const std::vector<uint8_t> &payload)
+{
+    std::vector<uint8_t> frame = encodeFrame(type, payload);
+    port.rx.insert(port.rx.end(), frame.begin(), frame.end());
+}
+
+// Tempo changes sent at points spread through the beat. The beat after the
+// one a change takes effect on has to be exactly one new interval later.
+static void test_tempo_change_starts_on_its_beat()
+{
+    TestSerial port;
+    SerialControl serialControl(port);
+    Metronome metronome;
+    metronome.begin();
+    metronome.setTempo(120);
+    metronome.start();
+
+    uint16_t requested = 120;
+    unsigned long effectTime = 0;
+    bool effective = false;
+    uint32_t beatCount = 0;
+    int changes = 0;
+    int wrongBeats = 0;
+    int wrongIntervals = 0;
+
+    for (unsigned long pass = 0; pass < 400000; pass++)
+    {
+        sim::advanceMicros(100);
+        metronome.update(true);
+        bool newBeat = metronome.getBeatCount() != beatCount;
+        beatCount = metronome.getBeatCount();
+
+        if (!effectTime && pass % 7919 == 0)
+        {
+            requested = requested == 120 ? 150 : 120;
+            sendFrame(port, SERIAL_SET_TEMPO, {uint8_t(requested & 0xFF), uint8_t(requested >> 8)});
+        }
+
+        if (serialControl.update())
+        {
+            SerialCommand command;
+            while (serialControl.nextCommand(command))
+            {
+                effectTime = metronome.setTempo(command.value, command.when);
+                effective = false;
+                newBeat = false; // Any beat this pass went out before it
+            }
+        }
+
+        if (!newBeat || !effectTime)
+        {
+            continue;
+        }
+
+        if (effective)
+        {
+            wrongIntervals += metronome.getLastBeat() - effectTime != 60000000UL / requested;
+            effectTime = 0;
+            changes++;
+        }
+        else
+        {
+            wrongBeats += metronome.getLastBeat() != effectTime;
+            effective = true;
+        }
+    }
+
+    TEST_ASSERT_GREATER_THAN(10, changes);
+    TEST_ASSERT_EQUAL_INT(0, wrongBeats);
+    TEST_ASSERT_EQUAL_INT(0, wrongIntervals);
+}
+
+static void test_damaged_frame_is_refused()
+{
+    TestSerial port;
+    SerialControl serialControl(port);
+    sendFrame(port, SERIAL_SET_TEMPO, {150, 0});
+    port.rx[3] ^= 0x01;
+
+    TEST_ASSERT_FALSE(serialControl.update());
+    TEST_ASSERT_TRUE(port.tx.size() >= 5);
+    TEST_ASSERT_EQUAL_UINT8(SERIAL_NAK, port.tx[1]);
+    TEST_ASSERT_EQUAL_UINT8(SERIAL_SET_TEMPO, port.tx[3]);
+    TEST_ASSERT_EQUAL_UINT8(SERIAL_ERROR_CHECKSUM, port.tx[4]);
+}
+
+static void test_unplayable_tempo_is_refused()
+{
+    TestSerial port;
+    SerialControl serialControl(port);
+    sendFrame(port, SERIAL_SET_TEMPO, {uint8_t(300 & 0xFF), uint8_t(300 >> 8)});
+
+    TEST_ASSERT_FALSE(serialControl.update());
+    TEST_ASSERT_EQUAL_UINT8(SERIAL_NAK, port.tx[1]);
+    TEST_ASSERT_EQUAL_UINT8(SERIAL_ERROR_BAD_VALUE, port.tx[4]);
+}
+
+// Three frames back to back, written in pieces of 1, 2, 3 and 5 bytes that
+// cut through every field, with the parser run after each piece. START's
+// type byte is ^C, which a tty not in raw mode would turn into a signal.
+static void test_split_frames_over_a_pty()
+{
+    PtySerial port;
+    TEST_ASSERT_TRUE(port.isOpen());
+    SerialControl serialControl(port);
+
+    std::vector<uint8_t> stream = encodeFrame(SERIAL_SET_TEMPO, {138, 0});
+    std::vector<uint8_t> start = encodeFrame(SERIAL_START, {});
+    std::vector<uint8_t> slower = encodeFrame(SERIAL_SET_TEMPO, {90, 0, TEMPO_NEXT_BAR});
+    stream.insert(stream.end(), start.begin(), start.end());
+    stream.insert(stream.end(), slower.begin(), slower.end());
+
+    static const size_t pieces[] = {1, 2, 3, 5};
+    std::vector<SerialCommand> commands;
+    for (size_t sent = 0, i = 0; sent < stream.size(); i++)
+    {
+        size_t size = min(pieces[i % 4], stream.size() - sent);
+        TEST_ASSERT_TRUE(port.hostWrite(&stream[sent], size));
+        sent += size;
+
+        serialControl.update();
+        SerialCommand command;
+        while (serialControl.nextCommand(command))
+        {
+            commands.push_back(command);
+        }
+    }
+
+    TEST_ASSERT_EQUAL_INT(3, commands.size());
+    TEST_ASSERT_EQUAL_UINT8(SERIAL_SET_TEMPO, commands[0].type);
+    TEST_ASSERT_EQUAL_UINT16(138, commands[0].value);
+    TEST_ASSERT_EQUAL_UINT8(SERIAL_START, commands[1].type);
+    TEST_ASSERT_EQUAL_UINT8(SERIAL_SET_TEMPO, commands[2].type);
+    TEST_ASSERT_EQUAL_UINT16(90, commands[2].value);
+    TEST_ASSERT_EQUAL_UINT8(TEMPO_NEXT_BAR, commands[2].when);
+    TEST_ASSERT_TRUE(port.hostRead(1).empty());
+}
+
+// A bad CRC and a bad payload byte each get a checksum NAK back on the
+// host's end, and the parser picks up the good frame that follows
+static void test_corrupted_frames_over_a_pty()
+{
+    PtySerial port;
+    TEST_ASSERT_TRUE(port.isOpen());
+    SerialControl serialControl(port);
+
+    std::vector<uint8_t> badCrc = encodeFrame(SERIAL_SET_TEMPO, {150, 0});
+    badCrc.back() ^= 0x80;
+    std::vector<uint8_t> badPayload = encodeFrame(SERIAL_SELECT_PATCH, {2});
+    badPayload[3] ^= 0x01;
+    std::vector<uint8_t> good = encodeFrame(SERIAL_STOP, {});
+
+    for (const std::vector<uint8_t> &frame : {badCrc, badPayload})
+    {
+        TEST_ASSERT_TRUE(port.hostWrite(frame.data(), frame.size()));
+        TEST_ASSERT_FALSE(serialControl.update());
+
+        std::vector<uint8_t> nak = port.hostRead(6);
+        TEST_ASSERT_EQUAL_INT(6, nak.size());
+        TEST_ASSERT_EQUAL_UINT8(SERIAL_SYNC, nak[0]);
+        TEST_ASSERT_EQUAL_UINT8(SERIAL_NAK, nak[1]);
+        TEST_ASSERT_EQUAL_UINT8(frame[1], nak[3]);
+        TEST_ASSERT_EQUAL_UINT8(SERIAL_ERROR_CHECKSUM, nak[4]);
+    }
+
+    TEST_ASSERT_TRUE(port.hostWrite(good.data(), good.size()));
+    TEST_ASSERT_TRUE(serialControl.update());
+    SerialCommand command;
+    TEST_ASSERT_TRUE(serialControl.nextCommand(command));
+    TEST_ASSERT_EQUAL_UINT8(SERIAL_STOP, command.type);
+    TEST_ASSERT_FALSE(serialControl.nextCommand(command));
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_tempo_change_starts_on_its_beat);
+    RUN_TEST(test_damaged_frame_is_refused);
+    RUN_TEST(test_unplayable_tempo_is_refused);
+    RUN_TEST(test_split_frames_over_a_pty);
+    RUN_TEST(test_corrupted_frames_over_a_pty);
+    return UNITY_END();
+}
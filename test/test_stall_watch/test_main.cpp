@@ -0,0 +1,171 @@
+// The loop stall watch: each stall blamed on the scope its time went to,
+// loop() run the way main.cpp runs it with flash commits and a slow web
+// client, and a stall the watchdog reset out of read back after the reset
+
+#include <Arduino.h>
+#include <Schedule.h>
+#include <new>
+#include <unity.h>
+#include "config.h"
+#include "metronome.h"
+#include "stall_watch.h"
+#include "storage.h"
+#include "wifi_manager.h"
+
+void setUp()
+{
+    sim::resetNetwork();
+    sim::clearSchedule();
+    stallWatch.clear();
+    stallWatch.begin();
+}
+
+void tearDown() {}
+
+// One loop() pass that spends `outside` us outside any scope and `inside`
+// us in the given subsystem's
+static void runPass(unsigned long outside, StallSubsystem subsystem, unsigned long inside)
+{
+    stallWatch.newPass();
+    sim::advanceMicros(outside);
+    STALL_SCOPE(subsystem);
+    sim::advanceMicros(inside);
+}
+
+// The stall goes to where most of its time went, nesting included
+static void test_stall_is_blamed_on_its_scope()
+{
+    runPass(15000, STALL_DISPLAY, 0);
+    runPass(2000, STALL_DISPLAY, 20000);
+    runPass(500, STALL_SERIAL, 5000);
+    {
+        stallWatch.newPass();
+        STALL_SCOPE(STALL_WEB);
+        sim::advanceMicros(2000);
+        {
+            STALL_SCOPE(STALL_STORAGE);
+            sim::advanceMicros(30000);
+        }
+    }
+    stallWatch.newPass();
+
+    TEST_ASSERT_EQUAL_UINT32(3, stallWatch.getStallCount());
+    TEST_ASSERT_EQUAL_UINT32(1, stallWatch.getStats(STALL_LOOP).count);
+    TEST_ASSERT_EQUAL_UINT32(1, stallWatch.getStats(STALL_DISPLAY).count);
+    TEST_ASSERT_EQUAL_UINT32(1, stallWatch.getStats(STALL_STORAGE).count);
+    TEST_ASSERT_EQUAL_UINT32(0, stallWatch.getStats(STALL_SERIAL).count);
+    TEST_ASSERT_EQUAL_UINT32(0, stallWatch.getStats(STALL_WEB).count);
+}
+
+// 20 s of loop(): a tab's saves commit flash, a script on a slow link holds
+// the web server for as long as its request takes to arrive, and now and
+// then time is lost outside any scope. Each pass does one of them, so every
+// stall has one cause to be blamed on.
+static void test_loop_stalls_match_their_causes()
+{
+    PatchTable table;
+    Settings settings = {1};
+    Display display;
+    Metronome metronome;
+    metronome.begin();
+    storage.begin();
+    Patch patches[MAX_PATCHES];
+    int count = defaultPatches(patches);
+
+    WiFiManager web(table, settings, display, metronome);
+    web.begin();
+    web.update();
+
+    sim::HttpClient script;
+    script.request = "GET /api/stalls HTTP/1.1\r\n\r\n";
+    script.byteGap = 20000;
+    bool connected = false;
+    unsigned long nextRequest = micros();
+
+    unsigned long expected[STALL_SUBSYSTEM_COUNT] = {};
+    unsigned long commits = storage.getCommitCount();
+    stallWatch.clear();
+    stallWatch.begin();
+    unsigned long begin = micros();
+    for (unsigned long pass = 1; micros() - begin < 20000000; pass++)
+    {
+        stallWatch.newPass();
+        sim::advanceMicros(200);
+        if (pass % 20000 == 0)
+        {
+            sim::advanceMicros(15000);
+            expected[STALL_LOOP]++;
+        }
+        else if (pass % 10000 == 5000)
+        {
+            patches[0].tempo = patches[0].tempo == 120 ? 121 : 120;
+            storage.savePatches(patches, count);
+        }
+        else
+        {
+            web.update();
+        }
+
+        if (connected && script.done)
+        {
+            connected = false;
+            nextRequest = script.done + 3000000;
+            expected[STALL_WEB]++;
+        }
+        if (!connected && (long)(micros() - nextRequest) >= 0)
+        {
+            std::string request = script.request;
+            script = sim::HttpClient();
+            script.request = request;
+            script.byteGap = 20000;
+            script.start = micros();
+            sim::connectClient(&script);
+            connected = true;
+        }
+    }
+    stallWatch.newPass();
+    sim::resetNetwork();
+    expected[STALL_STORAGE] = storage.getCommitCount() - commits;
+
+    TEST_ASSERT_GREATER_THAN(0, expected[STALL_LOOP]);
+    TEST_ASSERT_GREATER_THAN(0, expected[STALL_STORAGE]);
+    TEST_ASSERT_GREATER_THAN(0, expected[STALL_WEB]);
+    for (int i = 0; i < STALL_SUBSYSTEM_COUNT; i++)
+    {
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(expected[i], stallWatch.getStats(i).count, stallWatch.getName(i));
+    }
+
+    // The last answer counts every web stall but its own
+    std::string counts = "\"web\":{\"count\":" + std::to_string(expected[STALL_WEB] - 1);
+    TEST_ASSERT_TRUE(script.response.find(counts) != std::string::npos);
+}
+
+// RAM is gone after the reset, RTC memory is not
+static void test_stall_survives_watchdog_reset()
+{
+    runPass(0, STALL_STORAGE, 30000);
+    stallWatch.newPass();
+    {
+        STALL_SCOPE(STALL_DISPLAY);
+        sim::advanceMicros(8000000);
+    }
+    new (&stallWatch) StallWatch();
+    stallWatch.begin();
+
+    StallRecord worst[STALL_REPORT_COUNT];
+    TEST_ASSERT_EQUAL_INT(2, stallWatch.getWorst(worst, STALL_REPORT_COUNT));
+    TEST_ASSERT_EQUAL_UINT8(STALL_DISPLAY, worst[0].subsystem);
+    TEST_ASSERT_FALSE(worst[0].flags & STALL_FLAG_ENDED);
+    TEST_ASSERT_UINT32_WITHIN(STALL_SAMPLE_US, 8000000, worst[0].length);
+    TEST_ASSERT_EQUAL_UINT8(STALL_STORAGE, worst[1].subsystem);
+    TEST_ASSERT_TRUE(worst[1].flags & STALL_FLAG_ENDED);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_stall_is_blamed_on_its_scope);
+    RUN_TEST(test_loop_stalls_match_their_causes);
+    RUN_TEST(test_stall_survives_watchdog_reset);
+    return UNITY_END();
+}
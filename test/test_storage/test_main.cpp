@@ -0,0 +1,359 @@
+// Patch storage booted from random, damaged and legacy flash images. Every
+// boot must load a usable patch set, an upgrade must keep every legacy
+// patch, a damaged header must not lose the records, and a second boot must
+// not write flash.
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <unity.h>
+#include "config.h"
+#include "crc.h"
+#include "storage.h"
+#include "storage_schema.h"
+#include "tempo_curve.h"
+
+#define FUZZ_IMAGES 2000
+
+enum ImageKind
+{
+    IMAGE_RANDOM,
+    IMAGE_RANDOM_HEADER, // Random bytes behind a header that checks out
+    IMAGE_CURRENT_FLIPPED,
+    IMAGE_LEGACY,
+    IMAGE_LEGACY_FLIPPED
+};
+
+void setUp() {}
+
+void tearDown() {}
+
+// xorshift32, the same images on every run
+static uint32_t fuzzRandom(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static Patch randomPatch(uint32_t &state)
+{
+    Patch patch;
+    memset(&patch, 0, sizeof(patch));
+    for (int i = 0; i < 4; i++)
+    {
+        patch.name[i] = 32 + fuzzRandom(state) % 95;
+    }
+    patch.tempo = 40 + fuzzRandom(state) % 201;
+
+    uint8_t type = fuzzRandom(state) % 3;
+    if (type != CURVE_NONE)
+    {
+        int step = 1 + fuzzRandom(state) % 30;
+        patch.curve = {type, (int8_t)(fuzzRandom(state) % 2 ? step : -step),
+                       (uint16_t)(1 + fuzzRandom(state) % 255),
+                       (uint16_t)(40 + fuzzRandom(state) % 201)};
+    }
+    return patch;
+}
+
+// The layout firmware before the header wrote, in either of its older forms
+static void writeLegacyImage(uint8_t *image, const Patch *patches, int count, uint8_t brightness, bool withCrcs)
+{
+    memset(image, withCrcs ? 0 : 0xFF, STORAGE_SIZE);
+
+    LegacySettings settings;
+    memset(&settings, 0, sizeof(settings));
+    settings.brightness = brightness;
+    settings.checksum = withCrcs ? crc32(&settings.brightness, 1) : LEGACY_SETTINGS_CHECKSUM;
+    memcpy(image + LEGACY_SETTINGS_ADDR, &settings, sizeof(settings));
+
+    uint32_t crcs[MAX_PATCHES];
+    LegacyCurveTable curves;
+    memset(&curves, 0, sizeof(curves));
+    for (int i = 0; i < MAX_PATCHES; i++)
+    {
+        LegacyPatchRecord record;
+        memset(&record, 0, sizeof(record));
+        record.tempo = 120;
+        if (i < count)
+        {
+            memcpy(record.name, patches[i].name, 4);
+            record.tempo = patches[i].tempo;
+            const TempoCurve &curve = patches[i].curve;
+            curves.curves[i] = {curve.type, curve.step, curve.bars, curve.endTempo};
+        }
+        memcpy(image + LEGACY_PATCHES_ADDR + i * sizeof(record), &record, sizeof(record));
+        crcs[i] = withCrcs ? crc32(&record, sizeof(record)) : LEGACY_CRC_UNWRITTEN;
+    }
+    curves.crc = crc32(curves.curves, sizeof(curves.curves));
+    if (withCrcs)
+    {
+        memcpy(image + LEGACY_CRC_ADDR, crcs, sizeof(crcs));
+        memcpy(image + LEGACY_CURVE_ADDR, &curves, sizeof(curves));
+    }
+}
+
+// The current layout, as a Storage writes it
+static void writeCurrentImage(const Patch *patches, int count, uint8_t brightness)
+{
+    memset(EEPROM.getDataPtr(), 0, STORAGE_SIZE);
+    Storage writer;
+    writer.begin();
+    writer.saveSettings({brightness});
+    writer.savePatches(patches, count);
+}
+
+static bool samePatch(const Patch &a, const Patch &b)
+{
+    return strcmp(a.name, b.name) == 0 && a.tempo == b.tempo && a.curve.type == b.curve.type &&
+           (a.curve.type == CURVE_NONE || (a.curve.step == b.curve.step && a.curve.bars == b.curve.bars &&
+                                           a.curve.endTempo == b.curve.endTempo));
+}
+
+// What every load must hand the firmware, whatever flash held
+static bool loadSane(const Patch *patches, int count)
+{
+    if (count < 1 || count > MAX_PATCHES)
+    {
+        return false;
+    }
+    for (int i = 0; i < MAX_PATCHES; i++)
+    {
+        const Patch &patch = patches[i];
+        if (i >= count)
+        {
+            if (patch.name[0] != '\0')
+            {
+                return false;
+            }
+            continue;
+        }
+        for (int c = 0; c < 4; c++)
+        {
+            if (patch.name[c] < 32 || patch.name[c] > 126)
+            {
+                return false;
+            }
+        }
+        if (patch.name[4] != '\0' || patch.tempo < 40 || patch.tempo > 240 || !validateCurve(patch.curve))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct Boot
+{
+    Settings settings;
+    Patch patches[MAX_PATCHES];
+    int count;
+    unsigned long commits;
+};
+
+static Boot boot()
+{
+    Boot result;
+    Storage storage;
+    storage.begin();
+    result.settings = storage.loadSettings();
+    storage.loadPatches(result.patches, MAX_PATCHES);
+    result.count = storage.getCurrentNumPatches();
+    result.commits = storage.getCommitCount();
+    return result;
+}
+
+static bool sameBoot(const Boot &a, const Boot &b)
+{
+    bool same = a.settings.brightness == b.settings.brightness && a.count == b.count;
+    for (int i = 0; same && i < a.count; i++)
+    {
+        same = samePatch(a.patches[i], b.patches[i]);
+    }
+    return same;
+}
+
+// Loads that weren't sane, second boots that wrote or differed, and
+// upgrades that lost a legacy patch
+struct FuzzResult
+{
+    int insane;
+    int unstable;
+    int lost;
+};
+
+// Boots FUZZ_IMAGES images of one kind, twice each
+static FuzzResult fuzz(ImageKind kind)
+{
+    FuzzResult result = {};
+    uint32_t state = 0x2545F491 + kind;
+    for (int n = 0; n < FUZZ_IMAGES; n++)
+    {
+        uint8_t *image = EEPROM.getDataPtr();
+        Patch source[MAX_PATCHES];
+        memset(source, 0, sizeof(source));
+        int sourceCount = 1 + fuzzRandom(state) % MAX_PATCHES;
+        uint8_t brightness = fuzzRandom(state) % 16;
+        for (int i = 0; i < sourceCount; i++)
+        {
+            source[i] = randomPatch(state);
+        }
+
+        if (kind == IMAGE_RANDOM || kind == IMAGE_RANDOM_HEADER)
+        {
+            for (int i = 0; i < STORAGE_SIZE; i++)
+            {
+                image[i] = fuzzRandom(state);
+            }
+            if (kind == IMAGE_RANDOM_HEADER)
+            {
+                StoreHeader header;
+                memcpy(&header, image, sizeof(header));
+                header.magic = STORE_MAGIC;
+                header.version = STORE_VERSION + fuzzRandom(state) % 2;
+                header.count = fuzzRandom(state) % (MAX_PATCHES + 4);
+                header.recordSize = sizeof(PackedPatch) + fuzzRandom(state) % 8;
+                header.crc = crc32(&header, offsetof(StoreHeader, crc));
+                memcpy(image, &header, sizeof(header));
+            }
+        }
+        else if (kind == IMAGE_CURRENT_FLIPPED)
+        {
+            writeCurrentImage(source, sourceCount, brightness);
+        }
+        else
+        {
+            // Firmware from before the CRCs had no curves either
+            bool withCrcs = fuzzRandom(state) % 4 != 0;
+            for (int i = 0; !withCrcs && i < sourceCount; i++)
+            {
+                memset(&source[i].curve, 0, sizeof(source[i].curve));
+            }
+            writeLegacyImage(image, source, sourceCount, brightness, withCrcs);
+        }
+
+        if (kind == IMAGE_CURRENT_FLIPPED || kind == IMAGE_LEGACY_FLIPPED)
+        {
+            int flips = 1 + fuzzRandom(state) % 3;
+            for (int i = 0; i < flips; i++)
+            {
+                uint32_t bit = fuzzRandom(state) % (256 * 8);
+                image[bit / 8] ^= 1 << (bit % 8);
+            }
+        }
+
+        Boot first = boot();
+        result.insane += !loadSane(first.patches, first.count);
+
+        if (kind == IMAGE_LEGACY)
+        {
+            bool same = first.count == sourceCount && first.settings.brightness == brightness;
+            for (int i = 0; same && i < first.count; i++)
+            {
+                same = samePatch(first.patches[i], source[i]);
+            }
+            result.lost += !same;
+        }
+
+        Boot second = boot();
+        result.unstable += second.commits != 0 || !sameBoot(first, second);
+    }
+    return result;
+}
+
+static void test_random_images_load_sane()
+{
+    FuzzResult result = fuzz(IMAGE_RANDOM);
+    TEST_ASSERT_EQUAL_INT(0, result.insane);
+    TEST_ASSERT_EQUAL_INT(0, result.unstable);
+}
+
+static void test_random_records_behind_a_valid_header_load_sane()
+{
+    FuzzResult result = fuzz(IMAGE_RANDOM_HEADER);
+    TEST_ASSERT_EQUAL_INT(0, result.insane);
+    TEST_ASSERT_EQUAL_INT(0, result.unstable);
+}
+
+static void test_bit_flips_load_sane()
+{
+    FuzzResult result = fuzz(IMAGE_CURRENT_FLIPPED);
+    TEST_ASSERT_EQUAL_INT(0, result.insane);
+    TEST_ASSERT_EQUAL_INT(0, result.unstable);
+}
+
+static void test_legacy_upgrade_keeps_every_patch()
+{
+    FuzzResult result = fuzz(IMAGE_LEGACY);
+    TEST_ASSERT_EQUAL_INT(0, result.insane);
+    TEST_ASSERT_EQUAL_INT(0, result.unstable);
+    TEST_ASSERT_EQUAL_INT(0, result.lost);
+}
+
+static void test_damaged_legacy_images_load_sane()
+{
+    FuzzResult result = fuzz(IMAGE_LEGACY_FLIPPED);
+    TEST_ASSERT_EQUAL_INT(0, result.insane);
+    TEST_ASSERT_EQUAL_INT(0, result.unstable);
+}
+
+// Any one header byte past the magic going bad only costs the header. The
+// records are found at the current stride and a new header is written.
+static void test_bad_header_byte_keeps_the_patches()
+{
+    uint32_t state = 0x1234567;
+    Patch source[MAX_PATCHES];
+    memset(source, 0, sizeof(source));
+    for (int i = 0; i < 6; i++)
+    {
+        source[i] = randomPatch(state);
+    }
+
+    for (size_t byte = sizeof(uint32_t); byte < sizeof(StoreHeader); byte++)
+    {
+        writeCurrentImage(source, 6, 5);
+        EEPROM.getDataPtr()[STORE_HEADER_ADDR + byte] ^= 0x5A;
+
+        Boot first = boot();
+        TEST_ASSERT_EQUAL_INT(6, first.count);
+        for (int i = 0; i < 6; i++)
+        {
+            TEST_ASSERT_TRUE(samePatch(source[i], first.patches[i]));
+        }
+
+        Boot second = boot();
+        TEST_ASSERT_EQUAL_UINT32(0, second.commits);
+        TEST_ASSERT_TRUE(sameBoot(first, second));
+    }
+}
+
+// A boot loads the count that was saved, and the slots past it come back
+// empty
+static void test_save_keeps_the_count()
+{
+    Patch patches[MAX_PATCHES];
+    int count = defaultPatches(patches);
+    writeCurrentImage(patches, count, 1);
+
+    Boot loaded = boot();
+    TEST_ASSERT_EQUAL_INT(count, loaded.count);
+
+    writeCurrentImage(patches, 1, 1);
+    loaded = boot();
+    TEST_ASSERT_EQUAL_INT(1, loaded.count);
+    TEST_ASSERT_EQUAL_STRING("", loaded.patches[1].name);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_random_images_load_sane);
+    RUN_TEST(test_random_records_behind_a_valid_header_load_sane);
+    RUN_TEST(test_bit_flips_load_sane);
+    RUN_TEST(test_legacy_upgrade_keeps_every_patch);
+    RUN_TEST(test_damaged_legacy_images_load_sane);
+    RUN_TEST(test_bad_header_byte_keeps_the_patches);
+    RUN_TEST(test_save_keeps_the_count);
+    return UNITY_END();
+}
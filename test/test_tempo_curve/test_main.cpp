@@ -0,0 +1,110 @@
+// Tempo curves played by the metronome: every beat time against the curve
+// worked out in floating point, and the tempo shown on each beat
+
+#include <Arduino.h>
+#include <unity.h>
+#include <math.h>
+#include "config.h"
+#include "metronome.h"
+#include "realtime.h"
+#include "tempo_curve.h"
+
+void setUp()
+{
+    realtimeCore.begin();
+}
+
+void tearDown() {}
+
+static double curveTempo(int startTempo, const TempoCurve &curve, uint32_t beat)
+{
+    uint32_t beats = curve.bars * BEATS_PER_BAR;
+    if (curve.type == CURVE_LINEAR)
+    {
+        return beat < beats ? startTempo + (double)(curve.endTempo - startTempo) * beat / beats
+                            : curve.endTempo;
+    }
+
+    double tempo = startTempo + curve.step * (double)(beat / beats);
+    return curve.step > 0 ? min(tempo, (double)curve.endTempo) : max(tempo, (double)curve.endTempo);
+}
+
+// Plays 1000 beats of the curve. Beat times are whole us and the tempo is
+// fixed point, so a beat may be off the exact curve by a little over 1 us
+// but the error must not build up. The tempo shown is the curve's rounded
+// to a whole BPM.
+static void checkCurve(int startTempo, const TempoCurve &curve)
+{
+    Metronome metronome;
+    metronome.begin();
+    metronome.setTempo(startTempo, TEMPO_NOW, &curve);
+    metronome.start();
+
+    uint32_t beatCount = 0;
+    unsigned long firstBeat = 0;
+    double expected = 0;
+    double worst = 0;
+    int wrongTempo = 0;
+    while (beatCount < 1000)
+    {
+        sim::advanceMicros(100);
+        metronome.update(true);
+        if (metronome.getBeatCount() == beatCount)
+        {
+            continue;
+        }
+
+        // Beat n went out at the start of interval n
+        if (beatCount == 0)
+        {
+            firstBeat = metronome.getLastBeat();
+        }
+        else
+        {
+            expected += 60e6 / curveTempo(startTempo, curve, beatCount - 1);
+        }
+        worst = max(worst, fabs(metronome.getLastBeat() - firstBeat - expected));
+        wrongTempo += metronome.getTempo() != (int)lround(curveTempo(startTempo, curve, beatCount));
+        beatCount = metronome.getBeatCount();
+    }
+    metronome.stop();
+
+    TEST_ASSERT_TRUE(worst < 2.0);
+    TEST_ASSERT_EQUAL_INT(0, wrongTempo);
+}
+
+static void test_sweep_up()
+{
+    checkCurve(90, {CURVE_LINEAR, 0, 32, 140});
+}
+
+static void test_sweep_down()
+{
+    checkCurve(180, {CURVE_LINEAR, 0, 8, 60});
+}
+
+static void test_slow_sweep()
+{
+    checkCurve(60, {CURVE_LINEAR, 0, 200, 61});
+}
+
+static void test_steps_up()
+{
+    checkCurve(100, {CURVE_STEP, 5, 2, 130});
+}
+
+static void test_steps_down()
+{
+    checkCurve(120, {CURVE_STEP, -7, 1, 60});
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_sweep_up);
+    RUN_TEST(test_sweep_down);
+    RUN_TEST(test_slow_sweep);
+    RUN_TEST(test_steps_up);
+    RUN_TEST(test_steps_down);
+    return UNITY_END();
+}
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+"""Build each firmware variant and report their costs next to each other.
+
+    python3 tools/compare_builds.py
+    python3 tools/compare_builds.py --port /dev/ttyUSB0
+
+Flash and RAM come from PlatformIO's size summary. With --port each variant
+is also flashed and asked for its boot time and loop() pass times over the
+serial protocol (see tools/serial_control.py), so leave the pedal idle while
+it runs.
+"""
+import argparse
+import re
+import struct
+import subprocess
+import sys
+import time
+
+import serial_control
+
+ENVS = ["nodemcuv2_debug", "nodemcuv2_release", "nodemcuv2_stage"]
+
+SIZE = re.compile(r"^(RAM|Flash):.*\(used (\d+) bytes from (\d+) bytes\)", re.MULTILINE)
+
+
+def build(env, upload_port=None):
+    command = ["pio", "run", "-e", env]
+    if upload_port:
+        command += ["-t", "upload", "--upload-port", upload_port]
+    result = subprocess.run(command, capture_output=True, text=True)
+    if result.returncode != 0:
+        sys.exit(f"{env} failed to build:\n{result.stdout}{result.stderr}")
+    return {kind: int(used) for kind, used, _ in SIZE.findall(result.stdout)}
+
+
+def measure(path, settle):
+    """Boot time, then mean and worst loop() pass over settle seconds"""
+    port = serial_control.Port(path, 115200)
+    time.sleep(2)  # Boot, and whatever setup() leaves behind
+    port.send(serial_control.GET_STATS)  # Starts a fresh loop window
+    for kind, _ in port.frames(2.0):
+        if kind == serial_control.STATS:
+            break
+    time.sleep(settle)
+    port.send(serial_control.GET_STATS)
+    for kind, payload in port.frames(2.0):
+        if kind == serial_control.STATS:
+            return struct.unpack("<IHH", payload)
+    return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--port", help="flash each variant here and time it")
+    parser.add_argument("--settle", type=float, default=10.0,
+                        help="seconds of loop() passes to time")
+    parser.add_argument("envs", nargs="*", default=ENVS)
+    args = parser.parse_args()
+
+    rows = []
+    for env in args.envs:
+        sizes = build(env, args.port)
+        stats = measure(args.port, args.settle) if args.port else None
+        rows.append((env, sizes, stats))
+
+    print(f"{'variant':<20} {'flash':>9} {'RAM':>8} {'boot ms':>8} {'loop us':>8} {'worst us':>9}")
+    for env, sizes, stats in rows:
+        line = f"{env:<20} {sizes.get('Flash', 0):>9} {sizes.get('RAM', 0):>8}"
+        if stats:
+            boot, mean, worst = stats
+            line += f" {boot / 1000:>8.1f} {mean:>8} {worst:>9}"
+        elif args.port:
+            line += "   no answer"
+        print(line)
+
+
+if __name__ == "__main__":
+    main()
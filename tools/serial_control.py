@@ -0,0 +1,222 @@
+#!/usr/bin/env python3
+"""Drive the pedal over its binary serial protocol.
+
+    python3 tools/serial_control.py /dev/ttyUSB0 tempo 132 --when bar
+    python3 tools/serial_control.py /dev/ttyUSB0 query
+    python3 tools/serial_control.py /dev/ttyUSB0 stats
+    python3 tools/serial_control.py /dev/ttyUSB0 stalls
+    python3 tools/serial_control.py /dev/ttyUSB0 stream
+    python3 tools/serial_control.py /dev/ttyUSB0 latency --count 20
+
+Works on any tty, a pseudo-terminal included. Frame layout matches
+include/serial_control.h.
+"""
+import argparse
+import os
+import struct
+import sys
+import termios
+import time
+
+SYNC = 0xA5
+
+SET_TEMPO = 0x01
+SELECT_PATCH = 0x02
+START = 0x03
+STOP = 0x04
+QUERY = 0x05
+STREAM = 0x06
+GET_STATS = 0x07
+GET_STALLS = 0x08
+
+# When a SET_TEMPO takes effect, TempoChange in include/metronome.h
+WHEN = {"now": 0, "beat": 1, "bar": 2}
+
+ACK = 0x80
+STATE = 0x81
+BEAT = 0x82
+NAK = 0x83
+STATS = 0x84
+STALLS = 0x85
+STALL = 0x86
+
+ERRORS = {1: "bad checksum", 2: "unknown type", 3: "bad value", 4: "queue full"}
+MODES = {0: "patch", 1: "free"}
+# StallSubsystem in include/stall_watch.h
+SUBSYSTEMS = ["loop", "metronome", "buttons", "display", "storage", "wifi", "web", "serial"]
+STALL_FLAG_ENDED = 0x01
+
+
+def crc8(data):
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def encode(kind, payload=b""):
+    body = bytes([kind, len(payload)]) + payload
+    return bytes([SYNC]) + body + bytes([crc8(body)])
+
+
+class Port:
+    def __init__(self, path, baud):
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        attrs = termios.tcgetattr(self.fd)
+        attrs[0] = attrs[1] = attrs[3] = 0  # raw
+        attrs[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+        speed = getattr(termios, f"B{baud}")
+        attrs[4] = attrs[5] = speed
+        attrs[6][termios.VMIN] = 0
+        attrs[6][termios.VTIME] = 1
+        termios.tcsetattr(self.fd, termios.TCSANOW, attrs)
+        self.buffer = b""
+
+    def send(self, kind, payload=b""):
+        os.write(self.fd, encode(kind, payload))
+
+    def frames(self, timeout):
+        """Yields (kind, payload) until timeout seconds pass without a frame"""
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            self.buffer += os.read(self.fd, 256)
+            while True:
+                start = self.buffer.find(bytes([SYNC]))
+                if start < 0:
+                    self.buffer = b""
+                    break
+                frame = self.buffer[start:]
+                if len(frame) < 3 or len(frame) < 4 + frame[2]:
+                    self.buffer = frame
+                    break
+                length = frame[2]
+                body = frame[1:3 + length]
+                self.buffer = frame[4 + length:]
+                if crc8(body) != frame[3 + length]:
+                    continue  # debug text or noise, resync
+                deadline = time.monotonic() + timeout
+                yield body[0], body[2:]
+
+
+def describe(kind, payload):
+    if kind == ACK:
+        applied, = struct.unpack_from("<I", payload, 1)
+        return f"ack 0x{payload[0]:02x}, takes effect at {applied} us"
+    if kind == NAK:
+        return f"nak 0x{payload[0]:02x}: {ERRORS.get(payload[1], payload[1])}"
+    if kind == STATE:
+        mode, patch, running, tempo, next_beat = struct.unpack("<BBBHH", payload)
+        return (f"{MODES.get(mode, mode)} mode, patch {patch}, {tempo} BPM, "
+                f"{'running' if running else 'stopped'}, next beat in {next_beat} ms")
+    if kind == BEAT:
+        beat_time, tempo, patch = struct.unpack("<IHB", payload)
+        return f"beat at {beat_time} us, {tempo} BPM, patch {patch}"
+    if kind == STATS:
+        boot, mean, worst = struct.unpack("<IHH", payload)
+        return f"booted in {boot / 1000:.1f} ms, loop {mean} us mean, {worst} us worst"
+    if kind == STALLS:
+        count, stalls, budget = struct.unpack("<BII", payload)
+        return f"{stalls} loop() passes over {budget / 1000:.1f} ms since boot, longest {count} kept:"
+    if kind == STALL:
+        subsystem, flags, boots_ago, length, pc = struct.unpack("<BBBII", payload)
+        name = SUBSYSTEMS[subsystem] if subsystem < len(SUBSYSTEMS) else subsystem
+        when = "this boot" if boots_ago == 0 else f"{boots_ago} boot(s) ago"
+        ended = "" if flags & STALL_FLAG_ENDED else ", reset during it"
+        return f"  {length / 1000:9.1f} ms in {name} at 0x{pc:08x}, {when}{ended}"
+    return f"frame 0x{kind:02x} {payload.hex()}"
+
+
+def measure_latency(port, count):
+    """Host write to the ACK and to the BEAT the new tempo starts from"""
+    port.send(STREAM, b"\x01")
+    acks, beats = [], []
+    tempo = 120
+    for _ in range(count):
+        tempo = 150 if tempo == 120 else 120
+        sent = time.monotonic()
+        port.send(SET_TEMPO, struct.pack("<H", tempo))
+        effect = None
+        for kind, payload in port.frames(2.0):
+            if kind == ACK and payload[0] == SET_TEMPO:
+                acks.append((time.monotonic() - sent) * 1000)
+                effect, = struct.unpack_from("<I", payload, 1)
+            elif kind == BEAT and effect is not None:
+                beat_time, = struct.unpack_from("<I", payload)
+                if (beat_time - effect) & 0xFFFFFFFF < 0x80000000:
+                    beats.append((time.monotonic() - sent) * 1000)
+                    break
+            elif kind == NAK:
+                print(describe(kind, payload))
+                break
+    port.send(STREAM, b"\x00")
+
+    if not acks:
+        sys.exit("No response from the pedal")
+    print(f"command to ack: mean {sum(acks) / len(acks):.1f} ms, max {max(acks):.1f} ms")
+    if beats:
+        print(f"command to first beat at the new tempo: mean {sum(beats) / len(beats):.1f} ms, "
+              f"max {max(beats):.1f} ms")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("port", help="serial device or pseudo-terminal")
+    parser.add_argument("--baud", type=int, default=115200)
+    sub = parser.add_subparsers(dest="command", required=True)
+    tempo = sub.add_parser("tempo")
+    tempo.add_argument("bpm", type=int)
+    tempo.add_argument("--when", choices=WHEN, default="beat")
+    sub.add_parser("patch").add_argument("index", type=int)
+    sub.add_parser("start")
+    sub.add_parser("stop")
+    sub.add_parser("query")
+    sub.add_parser("stats")
+    sub.add_parser("stalls")
+    sub.add_parser("stream")
+    sub.add_parser("latency").add_argument("--count", type=int, default=20)
+    args = parser.parse_args()
+
+    port = Port(args.port, args.baud)
+
+    if args.command == "latency":
+        measure_latency(port, args.count)
+        return
+    if args.command == "stream":
+        port.send(STREAM, b"\x01")
+        try:
+            for kind, payload in port.frames(float("inf")):
+                print(describe(kind, payload))
+        except KeyboardInterrupt:
+            port.send(STREAM, b"\x00")
+        return
+
+    if args.command == "tempo":
+        port.send(SET_TEMPO, struct.pack("<HB", args.bpm, WHEN[args.when]))
+    elif args.command == "patch":
+        port.send(SELECT_PATCH, bytes([args.index]))
+    elif args.command == "start":
+        port.send(START)
+    elif args.command == "stop":
+        port.send(STOP)
+    elif args.command == "stats":
+        port.send(GET_STATS)
+    elif args.command == "stalls":
+        port.send(GET_STALLS)
+    else:
+        port.send(QUERY)
+
+    remaining = 0
+    for kind, payload in port.frames(2.0):
+        print(describe(kind, payload))
+        if kind == STALLS:
+            remaining = payload[0]
+        elif kind == STALL:
+            remaining -= 1
+        if kind in (ACK, NAK, STATE, STATS) or (kind in (STALLS, STALL) and remaining == 0):
+            break
+
+
+if __name__ == "__main__":
+    main()
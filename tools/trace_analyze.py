@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""Decode an event trace downloaded from the pedal and report beat timing.
+
+    curl -o trace.bin http://<ip>/api/trace
+    python3 tools/trace_analyze.py trace.bin
+
+Event layout matches include/trace.h.
+"""
+import argparse
+import statistics
+import struct
+import sys
+
+TRACE_MAGIC = 0x4352544D
+HEADER = struct.Struct("<IHHII")
+EVENT = struct.Struct("<IBBH")
+
+TRACE_BEAT = 1
+TRACE_BUTTON_EDGE = 2
+TRACE_GESTURE = 3
+TRACE_DISPLAY_FLUSH = 4
+TRACE_FLASH_COMMIT = 5
+TRACE_HTTP_REQUEST = 6
+TRACE_WIFI_STATE = 7
+TRACE_HTTP_DROPPED = 8
+
+HTTP_METHODS = {0: "ANY", 1: "GET", 2: "HEAD", 3: "POST", 4: "PUT", 5: "PATCH", 6: "DELETE", 7: "OPTIONS"}
+WIFI_STATES = {0: "connecting", 1: "connected", 2: "backoff"}
+GESTURES = {1: "press", 2: "click", 3: "long press", 4: "repeat", 5: "double tap", 6: "chord"}
+
+
+def load(path):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    magic, version, event_size, count, now = HEADER.unpack_from(data, 0)
+    if magic != TRACE_MAGIC:
+        sys.exit("Not a trace file")
+    if event_size != EVENT.size:
+        sys.exit(f"Unsupported event size {event_size} (version {version})")
+
+    events = []
+    last = None
+    offset = 0  # unwraps the 32-bit micros() counter
+    for i in range(count):
+        ts, kind, a, b = EVENT.unpack_from(data, HEADER.size + i * EVENT.size)
+        # Beats are logged a little after the LED fired them, only a big
+        # step back is the counter wrapping
+        if last is not None and ts + offset < last - (1 << 31):
+            offset += 1 << 32
+        last = ts + offset
+        if kind == TRACE_BEAT and version < 2:
+            b *= 1000  # Version 1 traced beat lateness in ms
+        events.append((ts + offset, kind, a, b))
+    events.sort(key=lambda e: e[0])
+    return events
+
+
+def describe(event):
+    ts, kind, a, b = event
+    if kind == TRACE_BEAT:
+        return f"beat, {b} us late"
+    if kind == TRACE_BUTTON_EDGE:
+        return f"pin {a} -> {'high' if b else 'low'}"
+    if kind == TRACE_GESTURE:
+        return f"{GESTURES.get(a, a)} on pin {b}"
+    if kind == TRACE_DISPLAY_FLUSH:
+        return f"display flush, {b} us"
+    if kind == TRACE_FLASH_COMMIT:
+        return f"flash commit, {b} ms"
+    if kind == TRACE_HTTP_REQUEST:
+        return f"HTTP {HTTP_METHODS.get(a, a)}, {b} ms"
+    if kind == TRACE_WIFI_STATE:
+        return f"wifi {WIFI_STATES.get(a, a)}"
+    if kind == TRACE_HTTP_DROPPED:
+        return f"HTTP request dropped after {b} ms"
+    return f"unknown type {kind} ({a}, {b})"
+
+
+def duration_us(event):
+    """How long a duration event kept the CPU busy before its timestamp"""
+    _, kind, _, b = event
+    if kind == TRACE_DISPLAY_FLUSH:
+        return b
+    if kind in (TRACE_FLASH_COMMIT, TRACE_HTTP_REQUEST, TRACE_HTTP_DROPPED):
+        return b * 1000
+    return 0
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def report_jitter(events):
+    beats = [e for e in events if e[1] == TRACE_BEAT]
+    if len(beats) < 2:
+        print("Not enough beats for jitter analysis")
+        return
+
+    lateness = [e[3] / 1000 for e in beats]
+    intervals = [(b[0] - a[0]) / 1000 for a, b in zip(beats, beats[1:])]
+    print(f"Beats: {len(beats)}")
+    print(f"  interval mean {statistics.mean(intervals):.2f} ms, "
+          f"stdev {statistics.pstdev(intervals):.2f} ms, "
+          f"min {min(intervals):.2f} ms, max {max(intervals):.2f} ms")
+    print(f"  lateness mean {statistics.mean(lateness):.3f} ms, "
+          f"p99 {percentile(lateness, 99):.3f} ms, max {max(lateness):.3f} ms")
+
+
+def report_input_latency(events):
+    latencies = []
+    press = {}
+    for ts, kind, a, b in events:
+        if kind == TRACE_BUTTON_EDGE and b == 0:
+            press.setdefault(a, ts)
+        elif kind == TRACE_GESTURE and b in press:
+            latencies.append((ts - press.pop(b)) / 1000)
+
+    if not latencies:
+        print("No button gestures recorded")
+        return
+
+    print(f"Gestures: {len(latencies)}")
+    print(f"  edge-to-action mean {statistics.mean(latencies):.2f} ms, "
+          f"max {max(latencies):.2f} ms")
+
+
+def report_late_beats(events, threshold):
+    late = [i for i, e in enumerate(events) if e[1] == TRACE_BEAT and e[3] >= threshold * 1000]
+    print(f"Beats at least {threshold} ms late: {len(late)}")
+
+    for i in late:
+        beat = events[i]
+        deadline = beat[0] - beat[3]
+        print(f"  {beat[0] / 1e6:.3f} s: {describe(beat)}, busy around the deadline:")
+
+        # Anything that was still running at the deadline or finished between
+        # it and the pulse, from the beats either side
+        culprits = []
+        for e in reversed(events[:i]):
+            if e[1] == TRACE_BEAT:
+                break
+            culprits.insert(0, e)
+        for e in events[i + 1:]:
+            if e[1] == TRACE_BEAT:
+                break
+            culprits.append(e)
+        culprits = [e for e in culprits
+                    if deadline <= e[0] <= beat[0] or e[0] - duration_us(e) <= deadline <= e[0]]
+        for e in culprits:
+            print(f"    {e[0] / 1e6:.3f} s: {describe(e)}")
+        if not culprits:
+            print("    nothing traced (loop was busy elsewhere)")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("trace", help="binary trace from /api/trace")
+    parser.add_argument("--late", type=float, default=5,
+                        help="lateness in ms that counts as a late beat (default 5, fractions allowed)")
+    parser.add_argument("--dump", action="store_true", help="print every event")
+    args = parser.parse_args()
+
+    events = load(args.trace)
+    print(f"{len(events)} events over {(events[-1][0] - events[0][0]) / 1e6:.1f} s"
+          if events else "Empty trace")
+    if not events:
+        return
+
+    if args.dump:
+        for e in events:
+            print(f"{e[0] / 1e6:10.6f} {describe(e)}")
+
+    report_jitter(events)
+    report_input_latency(events)
+    report_late_beats(events, args.late)
+
+
+if __name__ == "__main__":
+    main()